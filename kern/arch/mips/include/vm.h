@@ -67,6 +67,9 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/* And the reverse, for addresses returned by PADDR_TO_KVADDR. */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -116,14 +119,19 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct semaphore;
+struct addrspace;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* Address space the page is in */
+	vaddr_t ts_vaddr;		/* Page to invalidate */
+	struct semaphore *ts_done;	/* V'd once it has been, if not NULL */
 };
 
 #define TLBSHOOTDOWN_MAX 16
 
+/* ts_vaddr meaning every page of ts_as; never a page address */
+#define TLBSHOOTDOWN_ALL ((vaddr_t)-1)
+
 
 #endif /* _MIPS_VM_H_ */
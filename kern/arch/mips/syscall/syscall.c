@@ -118,6 +118,15 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS___kmprof:
+		err = sys___kmprof(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
 #if OPT_SYSCALLS
         case SYS_open:
             retval = sys_open((const_userptr_t)tf->tf_a0, (int)tf->tf_a1, (mode_t)tf->tf_a2, &err);
@@ -150,6 +159,32 @@ syscall(struct trapframe *tf)
         case SYS_fork:
             retval = sys_fork(tf, &err);
             break;
+
+        case SYS_fstat:
+            retval = sys_fstat((int)tf->tf_a0, (userptr_t)tf->tf_a1, &err);
+            break;
+
+        case SYS_setaffinity:
+            retval = sys_setaffinity((pid_t)tf->tf_a0, (uint32_t)tf->tf_a1, &err);
+            break;
+
+#if OPT_PAGING
+        case SYS_sbrk:
+            retval = sys_sbrk((intptr_t)tf->tf_a0, &err);
+            break;
+
+        case SYS_mmap:
+            retval = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2, (int)tf->tf_a3, (vaddr_t)tf->tf_sp, &err);
+            break;
+
+        case SYS_munmap:
+            retval = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, &err);
+            break;
+
+        case SYS_msync:
+            retval = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2, &err);
+            break;
+#endif
 #endif
 
 	    default:
@@ -0,0 +1,220 @@
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <addrspace.h>
+#include <mips/tlb.h>
+#include <vm.h>
+
+/*
+ * MIPS TLB handling for the paging VM system.
+ *
+ * Most of these operate on the current CPU's TLB only, with
+ * interrupts off so that a context switch can't get in between
+ * reading and writing an entry.
+ *
+ * Address space IDs are handed out per CPU, in order. An address
+ * space's ID on a CPU is kept in as_asid[] together with the
+ * generation it belongs to: the low bits are the ID, the rest count
+ * how many times the CPU has run out of IDs. ID 0 is never handed
+ * out, so a zero as_asid[] entry means "none". An ID from an old
+ * generation is as good as none, since the TLB was flushed when the
+ * generation changed.
+ */
+
+#define ASID_MASK	((uint32_t)NUM_ASID - 1)
+#define ASID_GEN(a)	((a) & ~ASID_MASK)
+
+int vmtlb_policy = VMTLB_RANDOM;
+
+/*
+ * Return AS's ID on this CPU, or 0 if it doesn't have a current one.
+ * Interrupts must be off.
+ */
+static
+uint32_t
+vmtlb_getasid(struct addrspace *as)
+{
+	uint32_t asid;
+
+	asid = as->as_asid[curcpu->c_number];
+	if ((asid & ASID_MASK) == 0 ||
+	    ASID_GEN(asid) != ASID_GEN(curcpu->c_asid)) {
+		return 0;
+	}
+	return asid & ASID_MASK;
+}
+
+/*
+ * Invalidate every entry without touching the current ASID.
+ */
+static
+void
+vmtlb_flushall(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlbstats.ts_flushes++;
+}
+
+void
+vmtlb_activate(struct addrspace *as)
+{
+	uint32_t asid;
+	int spl;
+
+	spl = splhigh();
+
+	asid = vmtlb_getasid(as);
+	if (asid == 0) {
+		asid = curcpu->c_asid + 1;
+		if ((asid & ASID_MASK) == 0) {
+			/* Out of IDs; start over with an empty TLB */
+			vmtlb_flushall();
+			asid++;
+		}
+		curcpu->c_asid = asid;
+		as->as_asid[curcpu->c_number] = asid;
+		curcpu->c_tlbstats.ts_asids++;
+		asid &= ASID_MASK;
+	}
+
+	curcpu->c_curasid = asid;
+	tlb_setasid(asid);
+
+	splx(spl);
+}
+
+void
+vmtlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable)
+{
+	uint32_t ehi, elo;
+	int i, spl;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	spl = splhigh();
+
+	KASSERT(curcpu->c_curasid != 0);
+	ehi = vaddr | (curcpu->c_curasid << TLBHI_PIDSHIFT);
+	elo = paddr | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/* Never load two entries for the same page. */
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+		splx(spl);
+		return;
+	}
+
+	/*
+	 * Don't go looking for an invalid slot: after the first few
+	 * faults following a flush there rarely is one, and reading all
+	 * NUM_TLB entries costs more than the refill it might save.
+	 */
+	if (vmtlb_policy == VMTLB_ROUNDROBIN) {
+		i = curcpu->c_tlbnext;
+		curcpu->c_tlbnext = (i + 1) % NUM_TLB;
+		tlb_write(ehi, elo, i);
+	}
+	else {
+		tlb_random(ehi, elo);
+	}
+	curcpu->c_tlbstats.ts_loads++;
+
+	splx(spl);
+}
+
+void
+vmtlb_invalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t asid;
+	int i, spl;
+
+	spl = splhigh();
+
+	asid = vmtlb_getasid(as);
+	if (asid != 0) {
+		i = tlb_probe((vaddr & PAGE_FRAME) | (asid << TLBHI_PIDSHIFT), 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		tlb_setasid(curcpu->c_curasid);
+	}
+
+	splx(spl);
+}
+
+void
+vmtlb_drop(struct addrspace *as)
+{
+	uint32_t asid;
+	int spl;
+
+	spl = splhigh();
+
+	asid = vmtlb_getasid(as);
+	if (asid != 0) {
+		/*
+		 * Retire the ID rather than hunting down its entries. If AS
+		 * is the address space in use here, give it a fresh one.
+		 */
+		as->as_asid[curcpu->c_number] = 0;
+		if (asid == curcpu->c_curasid) {
+			vmtlb_activate(as);
+		}
+	}
+
+	splx(spl);
+}
+
+bool
+vmtlb_mayhave(struct addrspace *as, struct cpu *c)
+{
+	uint32_t asid;
+
+	/*
+	 * Unlocked: c_asid only moves forward, so if we see an old value
+	 * the generations may match when they no longer do, which just
+	 * costs C an unnecessary interrupt.
+	 */
+	asid = as->as_asid[c->c_number];
+	return (asid & ASID_MASK) != 0 && ASID_GEN(asid) == ASID_GEN(c->c_asid);
+}
+
+void
+vmtlb_forget(struct addrspace *as)
+{
+	unsigned i;
+
+	/*
+	 * The IDs we take away won't be handed out again until the CPU
+	 * that owned them starts a new generation, which flushes the
+	 * entries tagged with them. Nobody else can be activating AS,
+	 * since it belongs to the current thread.
+	 */
+	for (i = 0; i < MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+
+	vmtlb_activate(as);
+}
+
+void
+vmtlb_flush(void)
+{
+	int spl;
+
+	spl = splhigh();
+	vmtlb_flushall();
+	tlb_setasid(curcpu->c_curasid);
+	splx(spl);
+}
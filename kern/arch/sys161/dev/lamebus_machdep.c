@@ -119,6 +119,23 @@ mainbus_bootstrap(void)
 	mips_timer_set(CPU_FREQUENCY / HZ);
 }
 
+/*
+ * Reprogram this cpu's on-chip timer. With the timer stopped it still
+ * goes off after 2^32 cycles, or about 171 seconds at 25 MHz; the
+ * interrupt handler below then puts it back to one period, and it's
+ * up to hardclock to stop it again.
+ */
+void
+mainbus_set_hardclock(unsigned ticks)
+{
+	if (ticks == 0 || ticks > 0xffffffff / (CPU_FREQUENCY / HZ)) {
+		mips_timer_set(0xffffffff);
+	}
+	else {
+		mips_timer_set(ticks * (CPU_FREQUENCY / HZ));
+	}
+}
+
 /*
  * Start all secondary CPUs.
  */
@@ -53,6 +53,7 @@
 #include <platform/bus.h>
 #include <vfs.h>
 #include <emufs.h>
+#include <kmem_cache.h>
 #include "autoconf.h"
 
 /* Register offsets */
@@ -414,6 +415,9 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 static int emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 			   struct emufs_vnode **ret);
 
+/* Where emufs_vnodes come from; created by the first emufs_addtovfs. */
+static struct kmem_cache *emufs_vnode_cache;
+
 /*
  * VOP_EACHOPEN on files
  */
@@ -529,7 +533,7 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
-	kfree(ev);
+	kmem_cache_free(emufs_vnode_cache, ev);
 	return 0;
 }
 
@@ -845,13 +849,16 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_MMAP
+ *
+ * Files can be mapped; the VM system pages them through emufs_read
+ * and emufs_write.
  */
 static
 int
 emufs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 //////////////////////////////
@@ -1171,7 +1178,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	/* Didn't have one; create it */
 
-	ev = kmalloc(sizeof(struct emufs_vnode));
+	ev = kmem_cache_alloc(emufs_vnode_cache);
 	if (ev==NULL) {
 		lock_release(ef->ef_emu->e_lock);
 		return ENOMEM;
@@ -1185,7 +1192,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
-		kfree(ev);
+		kmem_cache_free(emufs_vnode_cache, ev);
 		return result;
 	}
 
@@ -1195,7 +1202,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
-		kfree(ev);
+		kmem_cache_free(emufs_vnode_cache, ev);
 		return result;
 	}
 
@@ -1294,6 +1301,15 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 	struct emufs_fs *ef;
 	int result;
 
+	if (emufs_vnode_cache == NULL) {
+		emufs_vnode_cache = kmem_cache_create("emufs_vnode",
+						      sizeof(struct emufs_vnode),
+						      0, NULL, NULL);
+		if (emufs_vnode_cache == NULL) {
+			return ENOMEM;
+		}
+	}
+
 	ef = kmalloc(sizeof(struct emufs_fs));
 	if (ef==NULL) {
 		return ENOMEM;
@@ -42,6 +42,7 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include <kmem_cache.h>
 #include "sfsprivate.h"
 
 
@@ -408,6 +409,16 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENXIO;
 	}
 
+	if (sfs_vnode_cache == NULL) {
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    0, NULL, NULL);
+		if (sfs_vnode_cache == NULL) {
+			vfs_biglock_release();
+			return ENOMEM;
+		}
+	}
+
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
 		vfs_biglock_release();
@@ -33,6 +33,9 @@
 #include <uio.h> /* for uio_rw */
 
 
+/* vnode cache (in sfs_inode.c) */
+extern struct kmem_cache *sfs_vnode_cache;
+
 /* ops tables (in sfs_vnops.c) */
 extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
@@ -35,10 +35,57 @@
  */
 
 
+#include <array.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct pagetable;
+
+#if !OPT_DUMBVM
+/*
+ * A region is a range of virtual pages with uniform permissions,
+ * such as a segment of the executable or the stack. Pages in a
+ * region are not backed by anything until they are first touched;
+ * vm_fault then fills them with zeros, except for the part of the
+ * region (if any) that maps a file, which is read from the file.
+ */
+#define RG_READ         0x4     /* Readable */
+#define RG_WRITE        0x2     /* Writeable */
+#define RG_EXEC         0x1     /* Executable */
+
+/*
+ * Regions made by mmap can be unmapped again. In a shared one the
+ * pages are the file's pages in the page cache, and changes are
+ * written back to the file; anything else mapping a file gets a
+ * private copy of a page when it first writes to it. The heap is a
+ * region that sbrk grows and shrinks; it starts out empty, right
+ * after the executable's segments.
+ */
+#define RGF_MMAP        0x1     /* Made by mmap */
+#define RGF_SHARED      0x2     /* MAP_SHARED */
+#define RGF_HEAP        0x4     /* The heap */
+
+struct region {
+        vaddr_t rg_base;        /* First address (page-aligned) */
+        size_t rg_npages;       /* Length in pages */
+        int rg_perms;           /* RG_* */
+        int rg_flags;           /* RGF_* */
+        struct vnode *rg_vnode; /* File mapped into the region, or NULL */
+        vaddr_t rg_filebase;    /* First address the file is mapped at */
+        size_t rg_filesize;     /* Bytes of the file that are mapped */
+        off_t rg_offset;        /* File offset mapped at rg_filebase */
+};
+
+#ifndef ADDRSPACEINLINE
+#define ADDRSPACEINLINE INLINE
+#endif
+
+DECLARRAY(region, ADDRSPACEINLINE);
+DEFARRAY(region, ADDRSPACEINLINE);
+#endif
 
 
 /*
@@ -58,7 +105,14 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct regionarray as_regions;  /* Defined regions */
+        struct pagetable *as_pt;        /* Page table */
+        struct lock *as_lock;           /* Protects regions and page table */
+        bool as_loading;                /* Loading executable, ignore perms */
+        uint32_t as_asid[MAXCPUS];      /* TLB tag on each cpu (vmtlb.c) */
+        struct region *as_heap;         /* Heap region, once loaded */
+        struct region *as_stack;        /* Stack region, once defined */
+        vaddr_t as_brk;                 /* End of the heap (sbrk) */
 #endif
 };
 
@@ -118,6 +172,76 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+/*
+ * Find the region containing VADDR, or NULL if none does. The caller
+ * must hold as_lock.
+ */
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Back FILESIZE bytes at VADDR, which must lie within one region
+ * defined by as_define_region, with the contents of V starting at
+ * OFFSET. Nothing is read until the pages are touched. Takes its own
+ * reference to V.
+ */
+int               as_map_file(struct addrspace *as, vaddr_t vaddr,
+                              size_t filesize, struct vnode *v,
+                              off_t offset);
+
+/*
+ * Memory mappings, for the mmap family of system calls:
+ *
+ *    as_mmap   - make a region of LEN bytes with permissions PERMS
+ *                (RG_*) and flags FLAGS (RGF_SHARED or 0), mapping V
+ *                from OFFSET, or zero-filled if V is NULL. *ADDR is
+ *                where to put it if that is free, or anywhere if it
+ *                is 0; with FIXED it has to go there. FILESIZE is the
+ *                length of the file. Hands back the address in *ADDR.
+ *
+ *    as_munmap - unmap the pages in [VADDR, VADDR+LEN), which may
+ *                only belong to regions made by as_mmap. Regions are
+ *                shrunk or split as needed.
+ *
+ *    as_msync  - write changed pages of shared file mappings in
+ *                [VADDR, VADDR+LEN) back to their files.
+ */
+int               as_mmap(struct addrspace *as, vaddr_t *addr, size_t len,
+                          int perms, int flags, bool fixed,
+                          struct vnode *v, off_t offset, off_t filesize);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr, size_t len);
+
+/*
+ * Move the end of the heap by AMOUNT bytes, and hand back the old end
+ * in *OLDBRK. Growing only reserves the address space; pages appear
+ * when touched. Shrinking frees the pages given up right away.
+ */
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbrk);
+
+/*
+ * The stack region starts out a few pages long and grows down when
+ * something below it faults, one region-extension per fault, up to
+ * the stack limit. It never grows to within a page of another region,
+ * so there is always an unmapped guard page below it.
+ *
+ *    as_grow_stack     - extend AS's stack down to cover VADDR if that
+ *                        is allowed, and return the stack region; NULL
+ *                        if not. The caller must hold as_lock.
+ *
+ *    as_setstacklimit  - set the largest stack, in pages, for every
+ *                        address space. EINVAL if NPAGES is too small
+ *                        to hold an ARG_MAX argument block, or larger
+ *                        than the space left for the stack.
+ *
+ *    as_getstacklimit  - return it.
+ */
+struct region    *as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+int               as_setstacklimit(unsigned npages);
+unsigned          as_getstacklimit(void);
+#endif
+
 
 /*
  * Functions in loadelf.c
@@ -49,8 +49,26 @@ void hardclock_bootstrap(void);
 void hardclock(void);
 
 /*
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * Tickless idle: an idle cpu stops its hardclock instead of being
+ * woken HZ times a second for nothing.
+ *
+ *    hardclock_tickless_bootstrap - turn it on, once the time of day
+ *                                   clock is attached.
+ *    hardclock_idle    - called before each cpu_idle(). Stops the
+ *                        hardclock, unless WAKESOON says the cpu has
+ *                        a reason to look for work again next tick.
+ *    hardclock_resume  - called when the cpu has a thread to run;
+ *                        starts the hardclock again if it was stopped.
+ *    hardclock_printstats - print the hardclocks skipped, per cpu.
+ */
+void hardclock_tickless_bootstrap(void);
+void hardclock_idle(bool wakesoon);
+void hardclock_resume(void);
+void hardclock_printstats(void);
+
+/*
+ * timerclock() is called on one CPU once a second. It's a hook for
+ * once-a-second work; timed operations should use timers (timer.h).
  */
 void timerclock(void);
 
@@ -64,6 +82,7 @@ void gettime(struct timespec *ret);
  *
  * add: ret = t1 + t2
  * sub: ret = t1 - t2
+ * to_nsecs: t as a count of nanoseconds
  */
 
 void timespec_add(const struct timespec *t1,
@@ -72,12 +91,15 @@ void timespec_add(const struct timespec *t1,
 void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
+uint64_t timespec_to_nsecs(const struct timespec *t);
 
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocksleep_ticks() does the same for a number of hardclocks.
  */
 void clocksleep(int seconds);
+void clocksleep_ticks(unsigned ticks);
 
 
 #endif /* _CLOCK_H_ */
@@ -0,0 +1,176 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical memory management for the paging VM system.
+ *
+ * The coremap has one entry per physical frame of RAM. Before
+ * coremap_bootstrap is called, allocations are taken from
+ * ram_stealmem and can never be freed; afterwards every frame from
+ * the first free one up is tracked and can be released again.
+ */
+
+#include <vm.h>
+
+struct addrspace;
+
+/* Frame states */
+#define CME_FREE	0	/* In a free buddy block */
+#define CME_FIXED	1	/* Kernel image or stolen before bootstrap */
+#define CME_KERNEL	2	/* Kernel heap (alloc_kpages) */
+#define CME_USER	3	/* User page */
+#define CME_CACHED	4	/* Free, held in some CPU's page cache */
+#define CME_ZERO	5	/* Free and zero-filled, in the zero pool */
+#define CME_NSTATES 6
+
+/*
+ * Per-CPU page cache, kept in struct cpu. Single-page allocations and
+ * frees go through the current CPU's cache without touching the
+ * global coremap lock; the cache is refilled from and drained to the
+ * global free list CM_PCPU_BATCH frames at a time.
+ *
+ * Frame counts changed through the cache are accumulated in
+ * cp_counts and only folded into the global counts on the next
+ * refill or drain.
+ */
+#define CM_PCPU_FRAMES	16
+#define CM_PCPU_BATCH	8
+
+struct coremap_pcpu {
+	uint32_t cp_frames[CM_PCPU_FRAMES];	/* Cached free frames */
+	unsigned cp_nframes;
+	long cp_counts[CME_NSTATES];		/* Pending count changes */
+};
+
+/*
+ * Free memory is kept in buddy blocks of 2^0 up to 2^(CM_NORDERS-1)
+ * contiguous frames, so that is the largest multi-page allocation.
+ */
+#define CM_NORDERS	11
+
+/* Frame counts by state, for monitoring memory pressure */
+struct coremap_stats {
+	unsigned long cs_total;		/* All of physical memory */
+	unsigned long cs_free;		/* On the global free list */
+	unsigned long cs_cached;	/* Free in per-CPU caches */
+	unsigned long cs_fixed;		/* Kernel image and early boot */
+	unsigned long cs_kernel;	/* Kernel heap */
+	unsigned long cs_user;		/* User pages */
+	unsigned long cs_zeroed;	/* Free and zero-filled */
+	unsigned long cs_refills;	/* Per-CPU cache refills */
+	unsigned long cs_drains;	/* Per-CPU cache drains */
+	unsigned long cs_scans;		/* Frames examined by the clock */
+	unsigned long cs_evictions; /* Pages paged out to free a frame */
+	unsigned long cs_cleaned;	/* Dirty pages written out ahead */
+	unsigned long cs_zerohits;	/* Zero-fill faults served from the pool */
+	unsigned long cs_zeromisses; /* ...and those that zeroed their own */
+	unsigned long cs_zerofilled; /* Frames zeroed by idle cpus */
+	unsigned long cs_freeblocks[CM_NORDERS]; /* Free blocks by order */
+};
+
+/*
+ * Functions in coremap.c:
+ *
+ *    coremap_bootstrap    - take over physical memory from ram.c.
+ *                           Called once, from vm_bootstrap.
+ *
+ *    coremap_pcpu_init    - set up an empty per-CPU page cache.
+ *
+ *    coremap_alloc_kpages - allocate NPAGES physically contiguous
+ *                           frames for the kernel. A single page comes
+ *                           from the per-CPU cache, or by paging out a
+ *                           user page if memory is full; larger blocks
+ *                           come from the buddy allocator. Returns 0
+ *                           if out of memory.
+ *
+ *    coremap_alloc_upage  - allocate one frame for the user page that
+ *                           AS maps at VADDR, paging out another page
+ *                           if necessary. Returns 0 if out of memory.
+ *                           With AS NULL the page has no owner and is
+ *                           never paged out (for the page cache).
+ *
+ *    coremap_alloc_zpage  - the same, but hand back a zero-filled
+ *                           frame, from the zero pool if possible.
+ *
+ *    coremap_zero_idle    - zero one free frame and put it in the zero
+ *                           pool, unless the pool is full. Returns
+ *                           true if it did. For idle cpus; never
+ *                           sleeps, and zeroes with interrupts on,
+ *                           so call it holding no spinlocks.
+ *
+ *    coremap_free         - release an allocation, given the address
+ *                           of its first frame. Frees of memory stolen
+ *                           before bootstrap are ignored. For a shared
+ *                           user page this only drops one reference.
+ *
+ *    coremap_incref       - add a reference to a user page that is
+ *                           about to be mapped by another address
+ *                           space. The page loses its owner.
+ *
+ *    coremap_refcount     - return the number of references to a user
+ *                           page.
+ *
+ *    coremap_setowner     - give an unshared user page back an owner.
+ *
+ *    coremap_touch        - mark a user page recently used, for page
+ *                           replacement.
+ *
+ *    coremap_isdirty      - true if a user page has changed since it
+ *                           was last written to swap.
+ *
+ *    coremap_setdirty     - mark a user page changed. Releases its copy
+ *                           in swap, if any.
+ *
+ *    coremap_setclean     - record that a user page matches SLOT.
+ *
+ *    coremap_takeslot     - detach a clean page's swap slot for
+ *                           eviction; SWAP_NOSLOT if it has none.
+ *
+ *    coremap_clean        - write up to MAX dirty pages ahead of the
+ *                           clock hand to swap. Returns how many.
+ *
+ *    coremap_reclaim      - free one page: an unused page cache page,
+ *                           or else evict one. Returns false if nothing
+ *                           could be freed.
+ *
+ *    coremap_pageout_wait - sleep until fewer frames than the low
+ *                           watermark are on the free list. For the
+ *                           pageout thread.
+ *
+ *    coremap_setlowater   - set the low watermark.
+ *
+ *    coremap_getstats     - fill in per-state frame counts. These
+ *                           may lag behind changes made through
+ *                           per-CPU caches.
+ *
+ *    coremap_printstats   - print them.
+ *
+ *    coremap_printfrag    - print the free buddy blocks of each size,
+ *                           the largest, and how fragmented free
+ *                           memory is.
+ */
+
+void     coremap_bootstrap(void);
+void     coremap_pcpu_init(struct coremap_pcpu *cp);
+paddr_t  coremap_alloc_kpages(unsigned long npages);
+paddr_t  coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr);
+paddr_t  coremap_alloc_zpage(struct addrspace *as, vaddr_t vaddr);
+bool     coremap_zero_idle(void);
+void     coremap_free(paddr_t paddr);
+void     coremap_incref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void     coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void     coremap_touch(paddr_t paddr);
+bool     coremap_isdirty(paddr_t paddr);
+void     coremap_setdirty(paddr_t paddr);
+void     coremap_setclean(paddr_t paddr, unsigned slot);
+unsigned coremap_takeslot(paddr_t paddr);
+unsigned coremap_clean(unsigned max);
+bool     coremap_reclaim(void);
+void     coremap_pageout_wait(void);
+void     coremap_setlowater(unsigned long lowater);
+void     coremap_getstats(struct coremap_stats *cs);
+void     coremap_printstats(void);
+void     coremap_printfrag(void);
+
+#endif /* _COREMAP_H_ */
@@ -33,7 +33,17 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <kern/time.h>   /* for struct timespec */
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <kmalloc.h>     /* for struct kmalloc_pcpu */
+#include <timer.h>       /* for struct timerwheel */
+
+#include "opt-paging.h"
+
+#if OPT_PAGING
+#include <coremap.h>     /* for struct coremap_pcpu */
+#include <vm.h>          /* for struct vmtlb_stats */
+#endif
 
 
 /*
@@ -58,9 +68,24 @@ struct cpu {
 	 * Accessed only by this cpu.
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
+	struct thread *c_idlethread;	/* Idles here while curthread moves */
+	struct thread *c_moving;	/* Switched away from; to send on */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	bool c_tickless;		/* Idle with hardclock stopped (hint
+					   for other cpus; see clock.c) */
+	struct timespec c_ticklessstart; /* Tickless time counted up to */
+	unsigned c_ticklessclocks;	/* c_hardclocks at that point */
+	unsigned c_wakeupsavoided;	/* Hardclocks skipped while idle */
+	struct kmalloc_pcpu c_kmalloc;	/* kmalloc magazines (interrupts off) */
+#if OPT_PAGING
+	struct coremap_pcpu c_coremap;	/* Free page cache (interrupts off) */
+	struct vmtlb_stats c_tlbstats;	/* TLB counters (interrupts off) */
+	unsigned c_tlbnext;		/* Next slot for round-robin refill */
+	uint32_t c_asid;		/* Last ASID handed out, with generation */
+	uint32_t c_curasid;		/* ASID the TLB is using now */
+#endif
 
 	/*
 	 * Accessed by other cpus.
@@ -70,6 +95,12 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus (to stop timers).
+	 * Protected by its own lock.
+	 */
+	struct timerwheel c_timers;	/* Timers started on this cpu */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -112,6 +143,14 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Look up a cpu by software number (c_number), for code outside the
+ * thread system that keeps per-cpu state. cpu_count returns the
+ * number of cpus; cpu_get returns NULL if there is no such cpu.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned software_number);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -155,6 +194,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_batch queues N mappings for one CPU and sends it
+ * a single IPI for all of them.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +210,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_batch(struct cpu *target,
+			    const struct tlbshootdown *mappings, unsigned n);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,44 @@
+#ifndef _KERN_KMPROF_H_
+#define _KERN_KMPROF_H_
+
+/*
+ * Kernel heap profiler, for the __kmprof system call (libc's
+ * <sys/kmprof.h>) and the kernel's kmprof menu command.
+ */
+
+/* Operations */
+#define KMPROF_GET      0       /* Just read the statistics */
+#define KMPROF_START    1       /* Start recording */
+#define KMPROF_STOP     2       /* Stop recording */
+#define KMPROF_RESET    3       /* Throw away what was recorded */
+
+#define KMPROF_NSIZES   9       /* Subpage block sizes, then whole pages */
+#define KMPROF_MAXSITES 64      /* Call sites recorded */
+
+/* One kmalloc call site */
+struct kmprof_site {
+	__u32 ks_callsite;      /* Return address of the kmalloc call */
+	__u32 ks_allocs;
+	__u32 ks_frees;         /* Frees of blocks from here */
+	__u32 ks_livebytes;     /* Bytes from here not freed yet */
+	__u32 ks_totalbytes;    /* Bytes ever allocated from here */
+};
+
+/* One block size */
+struct kmprof_size {
+	__u32 kz_size;          /* Block size in bytes, 0 for whole pages */
+	__u32 kz_allocs;
+	__u32 kz_frees;
+};
+
+struct kmprof_stats {
+	__u32 kp_enabled;       /* Recording now */
+	__u32 kp_msecs;         /* Time spent recording */
+	__u32 kp_nsites;        /* Entries used in kp_sites */
+	__u32 kp_lostsites;     /* Allocations from sites past the table */
+	__u32 kp_untracked;     /* Blocks whose frees can't be charged */
+	struct kmprof_size kp_sizes[KMPROF_NSIZES];
+	struct kmprof_site kp_sites[KMPROF_MAXSITES];
+};
+
+#endif /* _KERN_KMPROF_H_ */
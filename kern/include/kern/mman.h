@@ -0,0 +1,30 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap, munmap and msync (libc's <sys/mman.h>).
+ */
+
+/* Protection bits for mmap */
+#define PROT_NONE	0x0	/* No access */
+#define PROT_READ	0x1	/* Readable */
+#define PROT_WRITE	0x2	/* Writeable */
+#define PROT_EXEC	0x4	/* Executable */
+
+/* Flags for mmap: choose one of these: */
+#define MAP_SHARED	0x0001	/* Changes go to the file and are shared */
+#define MAP_PRIVATE	0x0002	/* Changes are private to the process */
+/* then or in any of these: */
+#define MAP_FIXED	0x0010	/* Map exactly at the address given */
+#define MAP_ANON	0x1000	/* Not backed by a file; zero-filled */
+#define MAP_ANONYMOUS	MAP_ANON
+
+/* Returned by the libc mmap on error */
+#define MAP_FAILED	((void *)-1)
+
+/* Flags for msync */
+#define MS_ASYNC	0x1	/* Start writing (we always finish) */
+#define MS_INVALIDATE	0x2	/* Discard other cached copies */
+#define MS_SYNC		0x4	/* Write and wait */
+
+#endif /* _KERN_MMAN_H_ */
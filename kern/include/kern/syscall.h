@@ -64,7 +64,7 @@
 //#define SYS_mlock      13
 //#define SYS_munlock    14
 //#define SYS_munlockall 15
-//#define SYS_minherit   16
+#define SYS_msync        16
 //                              (security/credentials)
 #define SYS_umask        17
 #define SYS_issetugid    18
@@ -196,6 +196,8 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+#define SYS___kmprof     121
+#define SYS_setaffinity  122
 
 /*CALLEND*/
 
@@ -0,0 +1,55 @@
+#ifndef _KMALLOC_H_
+#define _KMALLOC_H_
+
+/*
+ * Per-CPU magazine layer of the kernel malloc (see kmalloc.c).
+ *
+ * Each CPU keeps up to two magazines of free blocks for each subpage
+ * block size, the loaded one and the previous one, and allocates from
+ * and frees into them with only interrupts off. When both are empty
+ * (or, for a free, both are full) the CPU swaps one with the global
+ * depot, which holds magazines for all CPUs, and only then takes a
+ * lock. Most kmalloc and kfree calls never get near the heap pages or
+ * kmalloc_spinlock.
+ *
+ * The prototypes of kmalloc and kfree themselves are in <lib.h>.
+ *
+ * kmalloc also has a profiler that can be turned on and off while the
+ * system runs; see kmalloc.c and <kern/kmprof.h>.
+ */
+
+#define KMALLOC_NSIZES	8	/* Subpage block sizes (sizes[]) */
+#define KMAG_ROUNDS	14	/* Blocks per magazine; sizeof(struct kmag) is 64 */
+#define KMAG_DEPOTMAX	8	/* Full (and empty) magazines kept per size */
+
+struct kmag;
+
+struct kmalloc_pcpu {
+	struct kmag *kp_loaded[KMALLOC_NSIZES];
+	struct kmag *kp_previous[KMALLOC_NSIZES];
+	unsigned long kp_hits;		/* Allocations served from a magazine */
+	unsigned long kp_misses;	/* ...and those that went to the pages */
+};
+
+/*
+ * kmalloc_pcpu_init sets up the empty magazines of a new cpu. Called
+ * from cpu_create.
+ */
+void kmalloc_pcpu_init(struct kmalloc_pcpu *kp);
+
+/*
+ * Profiler:
+ *
+ *    kmprof_control   - do one of the KMPROF_* operations. Returns an
+ *                       errno value.
+ *
+ *    kmprof_getstats  - fill in what has been recorded.
+ *
+ *    kmprof_printstats - print it.
+ */
+struct kmprof_stats;
+int kmprof_control(int op);
+void kmprof_getstats(struct kmprof_stats *ks);
+void kmprof_printstats(void);
+
+#endif /* _KMALLOC_H_ */
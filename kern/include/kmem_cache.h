@@ -0,0 +1,77 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches (slab allocator) for kernel structures that are
+ * allocated and freed all the time.
+ *
+ * A cache hands out objects of one type. They are carved out of whole
+ * pages (slabs) at exactly their own size, instead of being rounded
+ * up to the next kmalloc block size. If the cache has a constructor,
+ * it runs once when a slab is made, not on every allocation: an
+ * object has to be back in its constructed state when it is freed,
+ * and the next allocation gets it that way. The destructor runs when
+ * a slab is given back.
+ *
+ * Successive slabs start their objects at different offsets (slab
+ * coloring), so the same object in different slabs doesn't always
+ * land on the same processor cache lines.
+ */
+
+#include <spinlock.h>
+
+struct kmem_slab;
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* Object size asked for */
+	size_t kc_align;
+	size_t kc_stride;		/* Bytes per object in a slab */
+	size_t kc_linkoff;		/* Free list link, after the object */
+	unsigned kc_perslab;		/* Objects per slab */
+	size_t kc_maxcolor;		/* Largest offset of the first object */
+	size_t kc_nextcolor;		/* Offset for the next new slab */
+	void (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;
+	struct kmem_slab *kc_partial;	/* Slabs with some objects free */
+	struct kmem_slab *kc_full;	/* ...with none free */
+	struct kmem_slab *kc_empty;	/* ...with all of them free */
+	unsigned kc_nslabs;
+	unsigned kc_nempty;
+	unsigned long kc_inuse;		/* Objects allocated now */
+	unsigned long kc_allocs;	/* Allocations ever */
+
+	struct kmem_cache *kc_next;	/* All caches (kmem_cache.c) */
+};
+
+/*
+ * Functions in kmem_cache.c:
+ *
+ *    kmem_cache_create  - make a cache of objects of SIZE bytes, aligned
+ *                         to ALIGN (0 for the default, 8). CTOR and DTOR
+ *                         may be NULL. NAME must stay around as long as
+ *                         the cache does. Returns NULL if out of memory
+ *                         or if SIZE doesn't fit in a slab.
+ *
+ *    kmem_cache_destroy - destroy a cache; all its objects must have
+ *                         been freed.
+ *
+ *    kmem_cache_alloc   - allocate an object, or return NULL if out of
+ *                         memory.
+ *
+ *    kmem_cache_free    - free an object allocated from KC.
+ *
+ *    kmem_cache_printstats - print the usage of every cache.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align,
+				     void (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_printstats(void);
+
+#endif /* _KMEM_CACHE_H_ */
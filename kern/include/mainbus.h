@@ -52,6 +52,13 @@ void mainbus_interrupt(struct trapframe *);
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Make the current cpu's next hardclock come TICKS hardclock periods
+ * from now, and every period after that; or, if TICKS is 0, not for
+ * as long as the hardware can put it off. (Low-level; see clock.c.)
+ */
+void mainbus_set_hardclock(unsigned ticks);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
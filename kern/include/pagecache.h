@@ -0,0 +1,87 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Cache of file pages shared between address spaces, for the paging
+ * VM system.
+ *
+ * Private file mappings, which is mostly program text, don't get a
+ * private copy of each page until they write to it. vm_fault asks the
+ * page cache for the page instead, and maps the frame it gets
+ * copy-on-write. Every process running the same executable then
+ * shares one copy of its code, and only the first one to touch a page
+ * has to read it. Shared mappings (mmap with MAP_SHARED) map the
+ * cached frames directly, and their changes are written back to the
+ * file from the cache.
+ *
+ * The cache keeps one reference to each of its frames, so pages stay
+ * cached as long as the vnode is in memory, even if no process maps
+ * them for a while. Pages that nobody maps are given up when memory
+ * runs short. Writes and truncates through the file system update
+ * the cached pages in place, so every mapping sees them. A file's
+ * pages are dropped when its vnode is reclaimed, after writing back
+ * any changes.
+ */
+
+#include <vm.h>
+
+struct vnode;
+
+struct pagecache_stats {
+	unsigned long ps_pages;		/* Pages in the cache */
+	unsigned long ps_hits;		/* Lookups that found the page */
+	unsigned long ps_misses;	/* Lookups that read it in */
+	unsigned long ps_reclaimed; /* Unused pages freed for memory */
+	unsigned long ps_purged;	/* Pages dropped by write or reclaim */
+	unsigned long ps_written;	/* Dirty pages written to their file */
+};
+
+/*
+ * Functions in pagecache.c:
+ *
+ *    pagecache_get      - return in *RET the frame holding page INDEX
+ *                         (file offset INDEX * PAGE_SIZE) of VN, reading
+ *                         it in if necessary. The caller gets its own
+ *                         reference to the frame, to be dropped with
+ *                         coremap_free. It may only write to it through
+ *                         a shared mapping, after coremap_setdirty.
+ *
+ *    pagecache_writeback - write VN's dirty pages numbered INDEX to
+ *                         INDEX+NPAGES-1 back to the file. Pages that
+ *                         nobody maps any more become clean.
+ *
+ *    pagecache_flush    - write back all of VN's dirty pages.
+ *
+ *    pagecache_update   - after LEN bytes at OFFSET of VN were written,
+ *                         copy them into the pages of VN that are
+ *                         cached. Other changes in those pages made
+ *                         through shared mappings are kept.
+ *
+ *    pagecache_truncate - after VN was cut to SIZE bytes, zero what's
+ *                         past the end in its cached pages, and drop
+ *                         the pages wholly past it that nobody maps.
+ *
+ *    pagecache_purge    - drop all of VN's pages from the cache. Dirty
+ *                         ones are lost; flush first.
+ *
+ *    pagecache_reclaim  - free up to MAX clean cached pages that nobody
+ *                         maps.
+ *                         Returns the number freed.
+ *
+ *    pagecache_getstats - fill in the counters.
+ *
+ *    pagecache_printstats - print them.
+ */
+
+int      pagecache_get(struct vnode *vn, unsigned index, paddr_t *ret);
+int      pagecache_writeback(struct vnode *vn, unsigned index,
+			     unsigned npages);
+int      pagecache_flush(struct vnode *vn);
+void     pagecache_update(struct vnode *vn, off_t offset, off_t len);
+void     pagecache_truncate(struct vnode *vn, off_t size);
+void     pagecache_purge(struct vnode *vn);
+unsigned pagecache_reclaim(unsigned max);
+void     pagecache_getstats(struct pagecache_stats *ps);
+void     pagecache_printstats(void);
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,30 @@
+#ifndef _PAGEOUT_H_
+#define _PAGEOUT_H_
+
+/*
+ * Pageout thread for the paging VM system.
+ *
+ * A kernel thread sleeps until the number of free frames drops below
+ * the low watermark, then writes a batch of dirty pages out to swap
+ * ahead of the clock hand and evicts pages until the high watermark
+ * is reached again. Faults only have to evict pages themselves when
+ * it can't keep up.
+ */
+
+/*
+ * Functions in pageout.c:
+ *
+ *    pageout_bootstrap     - set default watermarks and start the
+ *                            thread. Called once, from vm_bootstrap.
+ *
+ *    pageout_setwatermarks - change the watermarks, in pages. Returns
+ *                            EINVAL unless 0 < LOW < HIGH <= memory.
+ *
+ *    pageout_printstats    - print watermarks and activity.
+ */
+
+void pageout_bootstrap(void);
+int  pageout_setwatermarks(unsigned long low, unsigned long high);
+void pageout_printstats(void);
+
+#endif /* _PAGEOUT_H_ */
@@ -0,0 +1,67 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-process page tables for the paging VM system.
+ *
+ * A page table is a two-level radix tree indexed by virtual page
+ * number: a directory of PT_NENTRIES pointers, each pointing to a
+ * second-level table of PT_NENTRIES page table entries. Second-level
+ * tables are only allocated when some page in the 4M they cover is
+ * actually touched, so sparse address spaces stay cheap.
+ */
+
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+/* Page table entry fields */
+#define PTE_FRAME	PAGE_FRAME	/* Physical frame, if PTE_VALID */
+#define PTE_VALID	0x00000001	/* Page is resident in memory */
+#define PTE_COW		0x00000002	/* Frame is shared; copy on write */
+#define PTE_SWAP	0x00000004	/* Page is in swap, not resident */
+#define PTE_WRITE	0x00000008	/* Dirty and writeable; may be mapped
+				   writeable without a fault */
+
+/* A swapped-out page keeps its swap slot where the frame would be */
+#define PTE_SLOT(pte)	((pte) >> 12)
+#define PTE_MKSWAP(slot) (((pte_t)(slot) << 12) | PTE_SWAP)
+#define PTE_MAXSLOTS	(1U << 20)
+
+#define PT_NENTRIES	1024
+#define PT_L1_INDEX(va) (((va) >> 22) & (PT_NENTRIES - 1))
+#define PT_L2_INDEX(va) (((va) >> 12) & (PT_NENTRIES - 1))
+#define PT_L1_SPAN	(PT_NENTRIES * PAGE_SIZE)
+
+struct pagetable {
+	pte_t *pt_dir[PT_NENTRIES];
+};
+
+/*
+ * Functions in pagetable.c:
+ *
+ *    pt_create  - create an empty page table. Returns NULL on
+ *                 out-of-memory error.
+ *
+ *    pt_destroy - free a page table and its second-level tables. Does
+ *                 not touch the frames the entries point to; the
+ *                 caller must release those first.
+ *
+ *    pt_lookup  - return the entry for VADDR. If the second-level
+ *                 table does not exist, allocate it if CREATE is set,
+ *                 otherwise return NULL. Also returns NULL if the
+ *                 allocation fails.
+ *
+ *    pt_walk    - call FUNC on every nonzero entry for addresses in
+ *                 [START, END). Stops early and returns the value
+ *                 FUNC returned if it is nonzero.
+ */
+
+struct pagetable *pt_create(void);
+void              pt_destroy(struct pagetable *pt);
+pte_t            *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int               pt_walk(struct pagetable *pt, vaddr_t start, vaddr_t end,
+			  int (*func)(vaddr_t vaddr, pte_t *pte, void *arg),
+			  void *arg);
+
+#endif /* _PAGETABLE_H_ */
@@ -68,6 +68,7 @@ struct proc {
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	unsigned p_numthreads;		/* Number of threads in this process */
+	uint32_t p_affinity;		/* CPUs its threads may run on */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
@@ -113,6 +114,10 @@ struct addrspace *proc_setas(struct addrspace *);
 /* Wait for process to terminate, and return the exit code */
 int proc_wait(struct proc *proc);
 
+/* Set the CPUs a process's threads may run on. */
+int proc_setaffinity(struct proc *proc, uint32_t mask);
+int proc_setaffinity_pid(pid_t pid, uint32_t mask);
+
 /* Find a process by PID */
 struct proc *proc_by_pid(pid_t pid);
 
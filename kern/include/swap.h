@@ -0,0 +1,56 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space for the paging VM system.
+ *
+ * Swap lives on a whole raw disk, divided into page-sized slots. A
+ * bitmap records which slots are in use. If the device can't be
+ * attached at boot the system runs without swap, and running out of
+ * memory is an ENOMEM as before.
+ */
+
+#include <vm.h>
+
+/* Disk to swap on, as vfs_swapon names it; the whole raw device is used */
+#define SWAP_DEVICE "lhd0"
+
+/* Not a slot */
+#define SWAP_NOSLOT 0xffffffff
+
+struct swap_stats {
+	unsigned long ss_slots;		/* Size of swap, in pages */
+	unsigned long ss_used;		/* Slots holding a page */
+	unsigned long ss_pageins;	/* Pages read back from swap */
+	unsigned long ss_pageouts;	/* Pages written to swap */
+};
+
+/*
+ * Functions in swap.c:
+ *
+ *    swap_bootstrap - attach SWAP_DEVICE. Called once, from
+ *                     vm_bootstrap.
+ *
+ *    swap_alloc     - reserve a free slot. Returns ENOSPC if swap is
+ *                     full or doesn't exist.
+ *
+ *    swap_free      - release a slot.
+ *
+ *    swap_out       - write the frame at PADDR to SLOT.
+ *
+ *    swap_in        - read SLOT into the frame at PADDR.
+ *
+ *    swap_getstats  - fill in swap usage and traffic counters.
+ *
+ *    swap_printstats - print them.
+ */
+
+void swap_bootstrap(void);
+int  swap_alloc(unsigned *slot);
+void swap_free(unsigned slot);
+int  swap_out(unsigned slot, paddr_t paddr);
+int  swap_in(unsigned slot, paddr_t paddr);
+void swap_getstats(struct swap_stats *ss);
+void swap_printstats(void);
+
+#endif /* _SWAP_H_ */
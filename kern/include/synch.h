@@ -66,9 +66,14 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * sem_timedP is P that gives up if the count stays 0 for TIMEOUT
+ * hardclocks (0: don't wait at all). Returns 0 if it decremented the
+ * count, or ETIMEDOUT.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int sem_timedP(struct semaphore *, unsigned timeout);
 
 
 /*
@@ -104,6 +109,8 @@ void lock_destroy(struct lock *);
  *                   same time.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
+ *    lock_tryacquire - Get the lock if nobody holds it, without blocking.
+ *                   Returns true if the lock was acquired.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
@@ -111,6 +118,7 @@ void lock_destroy(struct lock *);
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
+bool lock_tryacquire(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
 
@@ -146,8 +154,12 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - cv_wait, but wake up anyway after TIMEOUT hardclocks
+ *                   (at least one). Returns 0 if woken by cv_signal or
+ *                   cv_broadcast, ETIMEDOUT if not. As with cv_wait,
+ *                   recheck the condition after either.
  *
- * For all three operations, the current thread must hold the lock passed
+ * For all these operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
@@ -156,6 +168,7 @@ void cv_destroy(struct cv *);
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned timeout);
 
 
 #endif /* _SYNCH_H_ */
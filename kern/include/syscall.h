@@ -36,6 +36,7 @@
 #include "opt-syscalls.h"
 #include "opt-fork.h"
 #include "opt-file.h"
+#include "opt-paging.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -71,6 +72,8 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
+int sys___kmprof(int op, userptr_t user_stats);
 #if OPT_SYSCALLS
 int sys_open(const_userptr_t pathname, int flags, mode_t mode, int *errp);
 int sys_close(int fd, int *errp);
@@ -80,6 +83,15 @@ void sys__exit(int code, int *errp);
 pid_t sys_waitpid(pid_t pid, userptr_t returncode, int flags, int *errp);
 pid_t sys_getpid(int *errp);
 pid_t sys_fork(struct trapframe *tf, int *errp);
+int sys_fstat(int fd, userptr_t statbuf, int *errp);
+int sys_setaffinity(pid_t pid, uint32_t mask, int *errp);
+#endif
+#if OPT_PAGING
+vaddr_t sys_mmap(userptr_t addr, size_t len, int prot, int flags, vaddr_t sp,
+                 int *errp);
+int sys_munmap(userptr_t addr, size_t len, int *errp);
+int sys_msync(userptr_t addr, size_t len, int flags, int *errp);
+vaddr_t sys_sbrk(intptr_t amount, int *errp);
 #endif
 
 #endif /* _SYSCALL_H_ */
@@ -85,6 +85,14 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields; see schedule() in thread.c.
+	 */
+	unsigned t_priority;		/* Queue level, 0 is the highest */
+	unsigned t_quantum;		/* Hardclocks left at this level */
+	uint32_t t_affinity;		/* CPUs it may run on, one bit each */
+	unsigned t_lastran;		/* t_cpu's c_hardclocks when last run */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -109,6 +117,15 @@ struct thread {
 	/* add more here as needed */
 };
 
+/*
+ * CPU affinity masks: bit N of t_affinity is set if the thread may
+ * run on the cpu whose c_number is N. Threads start out able to run
+ * anywhere, and take on their process's mask (see proc_setaffinity).
+ */
+#define THREAD_AFFINITY_ALL	0xffffffff
+#define THREAD_AFFINITY_CPU(c)	((uint32_t)1 << (c)->c_number)
+#define THREAD_CANRUN(t, c)	(((t)->t_affinity & THREAD_AFFINITY_CPU(c)) != 0)
+
 /*
  * Array of threads.
  */
@@ -164,10 +181,12 @@ void thread_yield(void);
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge the current thread for a hardclock, and switch to another
+ * thread if its time is up or a better one is waiting. Called from
+ * the timer interrupt.
  */
-void thread_consider_migration(void);
+void thread_timeslice(void);
+
 
 
 #endif /* _THREAD_H_ */
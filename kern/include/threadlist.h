@@ -83,6 +83,9 @@ void threadlist_addtail(struct threadlist *tl, struct thread *t);
 struct thread *threadlist_remhead(struct threadlist *tl);
 struct thread *threadlist_remtail(struct threadlist *tl);
 
+/* Look at the head without removing it; NULL if empty */
+struct thread *threadlist_peekhead(struct threadlist *tl);
+
 /* Add and remove: in middle. (TL is needed to maintain ->tl_count.) */
 void threadlist_insertafter(struct threadlist *tl,
 			    struct thread *onlist, struct thread *addee);
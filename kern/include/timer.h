@@ -0,0 +1,92 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Kernel timers: call a function after some number of hardclocks.
+ *
+ * Each cpu keeps its pending timers in a hierarchical timing wheel,
+ * which its hardclock advances one tick at a time. Level 0 has a slot
+ * for each of the next TIMER_WHEELSIZE ticks; each slot of level N
+ * covers a whole turn of level N-1, and its timers are moved down
+ * ("cascaded") when the level below comes round to them. So starting,
+ * stopping and running a timer take constant time, whatever the
+ * number of timers, and a tick with nothing due costs next to nothing.
+ *
+ * A timer goes off on the cpu it was started on. Its function is
+ * called from that cpu's hardclock, in interrupt context, with no
+ * locks held: it must not sleep, and should be short.
+ */
+
+#include <spinlock.h>
+
+#define TIMER_WHEELBITS	6
+#define TIMER_WHEELSIZE	(1 << TIMER_WHEELBITS)	/* Slots per level */
+#define TIMER_LEVELS	4
+/* The longest a timer can be set for, about 46 hours at HZ=100 */
+#define TIMER_MAXTICKS	((1U << (TIMER_WHEELBITS * TIMER_LEVELS)) - 1)
+
+struct timerwheel;
+
+struct timer {
+	struct timer *tm_next;		/* In its wheel slot */
+	struct timer *tm_prev;
+	struct timer **tm_slot;		/* Slot it's in, if pending */
+	unsigned tm_expires;		/* Wheel tick it goes off at */
+	struct timerwheel *tm_wheel;	/* Wheel it was last started on */
+	void (*tm_func)(void *data);
+	void *tm_data;
+};
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	unsigned tw_now;		/* Next tick to run */
+	unsigned tw_lag;		/* Ticks gone by, not yet run */
+	unsigned tw_count;		/* Timers pending */
+	struct timer *tw_expired;	/* Due this tick, not yet run */
+	struct timer *tw_running;	/* Timer whose function is running */
+	struct timer *tw_slots[TIMER_LEVELS][TIMER_WHEELSIZE];
+};
+
+/*
+ * Functions in timer.c:
+ *
+ *    timer_init      - set up a timer to call FUNC(DATA) when it goes off.
+ *
+ *    timer_start     - start a timer that isn't pending, on the current
+ *                      cpu, to go off at that cpu's TICKSth hardclock
+ *                      from now (at least the next one; at most
+ *                      TIMER_MAXTICKS).
+ *
+ *    timer_stop      - stop a timer. Returns true if it was pending and
+ *                      now won't go off; false if it had already gone
+ *                      off (or was never started). Either way, its
+ *                      function is not running anywhere when this
+ *                      returns, so the timer may be freed. Must not be
+ *                      called from the timer's own function.
+ *
+ *    timer_pending   - true if a timer has been started and hasn't gone
+ *                      off or been stopped.
+ *
+ *    timerwheel_init    - set up a cpu's wheel (cpu_create).
+ *    timerwheel_advance - run NTICKS ticks of a cpu's wheel, plus any
+ *                         skipped, calling the functions of timers that
+ *                         come due (hardclock).
+ *    timerwheel_skip    - note that NTICKS ticks went by without the
+ *                         wheel running, while its cpu was tickless.
+ *                         They're run at the next timerwheel_advance;
+ *                         meanwhile timer_start counts from after them.
+ *    timerwheel_next    - how many ticks until the wheel may have timers
+ *                         to run, or 0 if it has none. (For tickless
+ *                         idle; may be early, never late.)
+ */
+void timer_init(struct timer *tm, void (*func)(void *data), void *data);
+void timer_start(struct timer *tm, unsigned ticks);
+bool timer_stop(struct timer *tm);
+bool timer_pending(struct timer *tm);
+
+void timerwheel_init(struct timerwheel *tw);
+void timerwheel_advance(struct timerwheel *tw, unsigned nticks);
+void timerwheel_skip(struct timerwheel *tw, unsigned nticks);
+unsigned timerwheel_next(struct timerwheel *tw);
+
+#endif /* _TIMER_H_ */
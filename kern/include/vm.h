@@ -40,9 +40,9 @@
 #include <machine/vm.h>
 
 /* Fault-type arguments to vm_fault() */
-#define VM_FAULT_READ        0    /* A read was attempted */
-#define VM_FAULT_WRITE       1    /* A write was attempted */
-#define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
+#define VM_FAULT_READ		0		/* A read was attempted */
+#define VM_FAULT_WRITE		1		/* A write was attempted */
+#define VM_FAULT_READONLY	2		/* A write to a readonly page was attempted*/
 
 
 /* Initialization function */
@@ -58,5 +58,104 @@ void free_kpages(vaddr_t addr);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+struct addrspace;
+struct cpu;
+
+/*
+ * Machine-dependent TLB management used by the paging VM system
+ * (in arch/<machine>/vm/vmtlb.c).
+ *
+ * TLB entries are tagged with an address space ID, so they survive
+ * context switches. Each CPU hands out its own IDs to the address
+ * spaces that run on it; when it runs out it flushes its TLB and
+ * starts a new generation, invalidating every ID it handed out.
+ *
+ *    vmtlb_activate   - switch this CPU's TLB to AS, giving AS an ID
+ *                       here if it doesn't have a current one.
+ *    vmtlb_load       - map VADDR to PADDR in this CPU's TLB for the
+ *                       current address space, replacing any existing
+ *                       mapping for VADDR.
+ *    vmtlb_invalidate - drop any mapping for VADDR in AS from this
+ *                       CPU's TLB.
+ *    vmtlb_drop       - drop every mapping for AS from this CPU's TLB.
+ *    vmtlb_mayhave    - true if the TLB of cpu C may hold mappings for
+ *                       AS, i.e. AS has a current ID there. Used to
+ *                       skip cpus in shootdowns; it can be wrong in
+ *                       the safe direction.
+ *    vmtlb_forget     - drop every mapping for AS from every CPU's TLB,
+ *                       by taking away its IDs. Only for the address
+ *                       space of the current thread.
+ *    vmtlb_flush      - drop all mappings from this CPU's TLB.
+ */
+void vmtlb_activate(struct addrspace *as);
+void vmtlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable);
+void vmtlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+void vmtlb_drop(struct addrspace *as);
+bool vmtlb_mayhave(struct addrspace *as, struct cpu *c);
+void vmtlb_forget(struct addrspace *as);
+void vmtlb_flush(void);
+
+/*
+ * TLB replacement policy for vmtlb_load, when the page isn't already
+ * in the TLB and some other entry has to go. Set with vm_setpolicy.
+ */
+#define VMTLB_RANDOM		0	/* Let the processor pick (tlb_random) */
+#define VMTLB_ROUNDROBIN 1	/* Cycle through the slots in order */
+
+extern int vmtlb_policy;
+
+/*
+ * Per-cpu TLB counters, in struct cpu. (Paging VM system only.)
+ */
+struct vmtlb_stats {
+	unsigned long ts_misses;	/* TLB faults taken */
+	unsigned long ts_refills;	/* ...resolved from the page table alone */
+	unsigned long ts_loads;		/* Entries written into a new TLB slot */
+	unsigned long ts_asids;		/* Address space IDs handed out */
+	unsigned long ts_flushes;	/* Whole-TLB flushes (ID generations) */
+	unsigned long ts_ipis;		/* Shootdown IPIs sent */
+	unsigned long ts_skipped;	/* ...and cpus that didn't need one */
+};
+
+/*
+ * TLB shootdown (paging VM system only):
+ *
+ *    vm_shootdown       - remove the N pages VADDRS[] of AS from every
+ *                         cpu's TLB, and wait until they all have.
+ *                         Each cpu that may hold mappings for AS gets
+ *                         one IPI for the lot; the others are left
+ *                         alone. Large batches drop all of AS instead.
+ *    vm_shootdown_ncpus - the same, but interrupt the first NCPUS other
+ *                         cpus whether they need it or not, and return
+ *                         how many there were. For benchmarking.
+ */
+void vm_shootdown(struct addrspace *as, const vaddr_t *vaddrs, unsigned n);
+unsigned vm_shootdown_ncpus(struct addrspace *as, const vaddr_t *vaddrs,
+			    unsigned n, unsigned ncpus);
+
+/*
+ * TLB statistics (paging VM system only):
+ *
+ *    vm_printtlbstats - print the counters of each cpu and the total.
+ *    vm_resettlbstats - zero them, e.g. before running a benchmark.
+ *    vm_setpolicy     - choose the replacement policy. Returns EINVAL
+ *                       if POLICY is not one of VMTLB_*.
+ */
+void vm_printtlbstats(void);
+void vm_resettlbstats(void);
+int vm_setpolicy(int policy);
+
+/*
+ * Called by the coremap on the user page AS maps at VADDR, which is
+ * in frame PADDR. (Paging VM system only.)
+ *
+ *    vm_evict - page it out, so the frame can be reused.
+ *    vm_clean - write it to swap if dirty, but leave it mapped.
+ *
+ * Both return EBUSY if AS is in use by someone else.
+ */
+int vm_evict(struct addrspace *as, vaddr_t vaddr, paddr_t paddr);
+int vm_clean(struct addrspace *as, vaddr_t vaddr, paddr_t paddr);
+
 
 #endif /* _VM_H_ */
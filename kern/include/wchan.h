@@ -34,6 +34,7 @@
  * Wait channel.
  */
 
+#include <timer.h>
 
 struct spinlock; /* in spinlock.h */
 struct wchan; /* Opaque */
@@ -76,5 +77,34 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Timed sleeps.
+ *
+ * wchan_timedsleep is wchan_sleep that gives up after TICKS
+ * hardclocks (at least one); it returns 0 if woken up, or ETIMEDOUT.
+ *
+ * To wait for a condition with a deadline, over as many sleeps as it
+ * takes, set a wchan_timeout going with wchan_timeout_start (LK
+ * held), then wchan_sleep as usual until the condition holds or
+ * wchan_timeout_isdone says time is up. Once time is up, the thread
+ * is woken if it's asleep on WC, and then wt_expired is set (it's
+ * protected by LK); if something else woke it first, it isn't. Call
+ * wchan_timeout_stop before the wchan_timeout goes away; it may drop
+ * and retake LK.
+ */
+struct wchan_timeout {
+	struct timer wt_timer;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	struct thread *wt_thread;
+	bool wt_expired;		/* The timer woke us */
+};
+
+int wchan_timedsleep(struct wchan *wc, struct spinlock *lk, unsigned ticks);
+void wchan_timeout_start(struct wchan_timeout *wt, struct wchan *wc,
+			 struct spinlock *lk, unsigned ticks);
+bool wchan_timeout_isdone(struct wchan_timeout *wt);
+void wchan_timeout_stop(struct wchan_timeout *wt);
+
 
 #endif /* _WCHAN_H_ */
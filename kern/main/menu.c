@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <kern/reboot.h>
 #include <kern/unistd.h>
+#include <kern/kmprof.h>
 #include <limits.h>
 #include <lib.h>
 #include <uio.h>
@@ -43,9 +44,20 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <kmalloc.h>
+#include <kmem_cache.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-argv.h"
+#include "opt-paging.h"
+
+#if OPT_PAGING
+#include <addrspace.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <pageout.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -465,10 +477,164 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if OPT_PAGING
+	coremap_printfrag();
+#endif
+
+	return 0;
+}
+
+/*
+ * Command for the kmalloc profiler: start, stop, or reset it, or just
+ * print what it has.
+ */
+static
+int
+cmd_kmprof(int nargs, char **args)
+{
+	int op, result;
+
+	if (nargs == 1) {
+		op = KMPROF_GET;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "start")) {
+		op = KMPROF_START;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "stop")) {
+		op = KMPROF_STOP;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		op = KMPROF_RESET;
+	}
+	else {
+		kprintf("Usage: kmprof [start | stop | reset]\n");
+		return EINVAL;
+	}
+
+	result = kmprof_control(op);
+	if (result) {
+		return result;
+	}
+	kmprof_printstats();
+	return 0;
+}
+
+static
+int
+cmd_kmemcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_idlestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	hardclock_printstats();
+
+	return 0;
+}
+
+#if OPT_PAGING
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+	swap_printstats();
+	pagecache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_pageout(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 3) {
+		result = pageout_setwatermarks(atoi(args[1]), atoi(args[2]));
+		if (result) {
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: pageout [lowater hiwater]\n");
+		return EINVAL;
+	}
+
+	pageout_printstats();
 
 	return 0;
 }
 
+static
+int
+cmd_tlbstats(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "random")) {
+		result = vm_setpolicy(VMTLB_RANDOM);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "rr")) {
+		result = vm_setpolicy(VMTLB_ROUNDROBIN);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vm_resettlbstats();
+		result = 0;
+	}
+	else if (nargs == 1) {
+		result = 0;
+	}
+	else {
+		kprintf("Usage: tlb [random | rr | reset]\n");
+		return EINVAL;
+	}
+	if (result) {
+		return result;
+	}
+
+	vm_printtlbstats();
+
+	return 0;
+}
+
+static
+int
+cmd_stacklimit(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2) {
+		result = as_setstacklimit(atoi(args[1]));
+		if (result) {
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: stack [pages]\n");
+		return EINVAL;
+	}
+
+	kprintf("User stack limit: %u pages\n", as_getstacklimit());
+
+	return 0;
+}
+#endif
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -564,17 +730,23 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[pb]  Page allocator benchmark      ",
+	"[eb]  Exec latency benchmark        ",
+	"[km]  kfree latency benchmark       ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
 #if OPT_NET
 	"[net] Network test                  ",
+#endif
+#if OPT_PAGING
+	"[sb]  TLB shootdown benchmark       ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
-	"[semu1-22] Semaphore unit tests     ",
+	"[semu1-24] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -605,6 +777,15 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[kc] Kernel object caches           ",
+	"[kmprof] kmalloc profiler           ",
+	"[idle] Tickless idle stats          ",
+#if OPT_PAGING
+	"[cm] Physical memory and swap stats ",
+	"[pageout] Pageout watermarks        ",
+	"[tlb] TLB replacement policy/stats  ",
+	"[stack] User stack limit            ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -656,6 +837,15 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "kc",         cmd_kmemcachestats },
+	{ "kmprof",     cmd_kmprof },
+	{ "idle",       cmd_idlestats },
+#if OPT_PAGING
+	{ "cm",         cmd_coremapstats },
+	{ "pageout",    cmd_pageout },
+	{ "tlb",        cmd_tlbstats },
+	{ "stack",      cmd_stacklimit },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -666,8 +856,14 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "pb",		pagebench },
+	{ "eb",		execbench },
+	{ "km",		kfreebench },
 #if OPT_NET
 	{ "net",	nettest },
+#endif
+#if OPT_PAGING
+	{ "sb",		shootbench },
 #endif
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
@@ -702,6 +898,8 @@ static struct {
 	{ "semu20",	semu20 },
 	{ "semu21",	semu21 },
 	{ "semu22",	semu22 },
+	{ "semu23",	semu23 },
+	{ "semu24",	semu24 },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
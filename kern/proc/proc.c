@@ -43,13 +43,17 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <spl.h>
+#include <cpu.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <synch.h>
 #include <syscall.h>
+#include <kmem_cache.h>
 
 #if OPT_WAITPID
 #define MAX_PROC 100
@@ -68,6 +72,22 @@ struct processtable processtable = {.pt_list = {NULL}, .pt_lastpid = 0, .pt_lock
  */
 struct proc *kproc;
 
+/* Where proc structures come from. */
+static struct kmem_cache *proc_cache;
+
+/*
+ * Constructor for proc_cache. proc_destroy leaves p_lock unheld, so
+ * it stays initialized between uses.
+ */
+static
+void
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_init(&proc->p_lock);
+}
+
 static
 void
 processtable_add(struct proc *proc)
@@ -141,12 +161,14 @@ processtable_search(pid_t pid)
 #if OPT_WAITPID
     struct proc *proc;
 
-    KASSERT((pid > 0) && (pid <= MAX_PROC));
+    if ((pid <= 0) || (pid > MAX_PROC)) {
+        return NULL;
+    }
 
     spinlock_acquire(&processtable.pt_lock);
 
     proc = processtable.pt_list[pid];
-    KASSERT(proc->p_pid == pid);
+    KASSERT((proc == NULL) || (proc->p_pid == pid));
 
     spinlock_release(&processtable.pt_lock);
 
@@ -166,18 +188,19 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
 	proc->p_numthreads = 0;
-	spinlock_init(&proc->p_lock);
+	proc->p_affinity = THREAD_AFFINITY_ALL;
+	/* p_lock was set up by proc_ctor */
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -280,7 +303,7 @@ proc_destroy(struct proc *proc)
     processtable_remove(proc);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -289,6 +312,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc), 0,
+				       proc_ctor, NULL);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -327,6 +356,8 @@ proc_create_runprogram(const char *name)
 		VOP_INCREF(curproc->p_cwd);
 		newproc->p_cwd = curproc->p_cwd;
 	}
+	/* Children stay pinned where their parent was */
+	newproc->p_affinity = curproc->p_affinity;
 	spinlock_release(&curproc->p_lock);
 
 	return newproc;
@@ -350,6 +381,7 @@ proc_addthread(struct proc *proc, struct thread *t)
 
 	spinlock_acquire(&proc->p_lock);
 	proc->p_numthreads++;
+	t->t_affinity = proc->p_affinity;
 	spinlock_release(&proc->p_lock);
 
 	spl = splhigh();
@@ -430,6 +462,73 @@ proc_setas(struct addrspace *newas)
 	return oldas;
 }
 
+/*
+ * Set the cpus the threads of a process may run on, as a mask with a
+ * bit for each cpu number. Bits for cpus that don't exist are
+ * ignored; if that leaves none, fail with EINVAL.
+ *
+ * The threads pick up the new mask the next time they go through the
+ * scheduler (see thread_getaffinity), which for a running thread is
+ * at the next hardclock. Threads forked later, and the processes
+ * forked from this one, inherit it.
+ */
+int
+proc_setaffinity(struct proc *proc, uint32_t mask)
+{
+	unsigned numcpus;
+
+	KASSERT(proc != NULL);
+
+	numcpus = cpu_count();
+	if (numcpus < 32) {
+		mask &= ((uint32_t)1 << numcpus) - 1;
+	}
+	if (mask == 0) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	proc->p_affinity = mask;
+	spinlock_release(&proc->p_lock);
+	return 0;
+}
+
+/*
+ * proc_setaffinity for the process PID. The process table stays
+ * locked throughout, so the process can't exit and be destroyed
+ * between finding it and changing it.
+ */
+int
+proc_setaffinity_pid(pid_t pid, uint32_t mask)
+{
+#if OPT_WAITPID
+	struct proc *proc;
+	int result;
+
+	if (pid <= 0 || pid > MAX_PROC) {
+		return ESRCH;
+	}
+
+	spinlock_acquire(&processtable.pt_lock);
+	proc = processtable.pt_list[pid];
+	if (proc == NULL) {
+		result = ESRCH;
+	}
+	else if (proc == kproc) {
+		result = EPERM;
+	}
+	else {
+		result = proc_setaffinity(proc, mask);
+	}
+	spinlock_release(&processtable.pt_lock);
+	return result;
+#else
+	(void)pid;
+	(void)mask;
+	return ESRCH;
+#endif
+}
+
 int
 proc_wait(struct proc *proc)
 {
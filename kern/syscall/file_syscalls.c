@@ -4,6 +4,7 @@
 #include <kern/unistd.h>
 #include <lib.h>
 #include <uio.h>
+#include <stat.h>
 #include <vnode.h>
 #include <copyinout.h>
 #include <proc.h>
@@ -280,3 +281,40 @@ sys_write(int fd, const_userptr_t buf_ptr, size_t size, int *errp)
 
     return (ssize_t)size;
 }
+
+int
+sys_fstat(int fd, userptr_t statbuf, int *errp)
+{
+#if OPT_FILE
+    struct openfile *of;
+    struct stat st;
+    int result;
+
+    if ((fd < 0) || (fd >= OPEN_MAX)) {
+        *errp = EBADF;
+        return -1;
+    }
+
+    of = curproc->p_filetable[fd];
+    if (of == NULL || of->vn == NULL) {
+        *errp = EBADF;
+        return -1;
+    }
+
+    result = VOP_STAT(of->vn, &st);
+    if (result == 0) {
+        result = copyout(&st, statbuf, sizeof(st));
+    }
+    if (result) {
+        *errp = result;
+        return -1;
+    }
+
+    return 0;
+#else
+    (void)fd;
+    (void)statbuf;
+    *errp = ENOSYS;
+    return -1;
+#endif
+}
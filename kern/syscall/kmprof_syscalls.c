@@ -0,0 +1,36 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/kmprof.h>
+#include <lib.h>
+#include <kmalloc.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * Control the kmalloc profiler, and copy out what it has recorded if
+ * USER_STATS isn't NULL. See <kern/kmprof.h>.
+ */
+int
+sys___kmprof(int op, userptr_t user_stats)
+{
+	struct kmprof_stats *ks;
+	int result;
+
+	result = kmprof_control(op);
+	if (result) {
+		return result;
+	}
+	if (user_stats == NULL) {
+		return 0;
+	}
+
+	ks = kmalloc(sizeof(*ks));
+	if (ks == NULL) {
+		return ENOMEM;
+	}
+	kmprof_getstats(ks);
+	result = copyout(ks, user_stats, sizeof(*ks));
+	kfree(ks);
+
+	return result;
+}
@@ -42,8 +42,10 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * With the paging VM system, segments aren't loaded at all: each one
+ * is mapped from the executable with as_map_file and read in a page
+ * at a time as the program touches it, so exec time doesn't depend
+ * on the size of the program.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -60,6 +62,7 @@
 #include <vnode.h>
 #include <elf.h>
 
+#if OPT_DUMBVM
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -144,6 +147,28 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#else
+/*
+ * Map a segment at virtual address VADDR, with the same arguments as
+ * load_segment above. The pages are filled in on first touch.
+ */
+static
+int
+map_segment(struct addrspace *as, struct vnode *v,
+	    off_t offset, vaddr_t vaddr,
+	    size_t memsize, size_t filesize)
+{
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	return as_map_file(as, vaddr, filesize, v, offset);
+}
+#endif
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -259,7 +284,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Now actually load (or map) each segment.
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
@@ -288,9 +313,14 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#else
+		result = map_segment(as, v, ph.p_offset, ph.p_vaddr,
+				     ph.p_memsz, ph.p_filesz);
+#endif
 		if (result) {
 			return result;
 		}
@@ -66,6 +66,36 @@ sys_waitpid(pid_t pid, userptr_t returncode, int flags, int *errp)
 #endif
 }
 
+/*
+ * Pin process PID, or the caller if PID is 0, to the cpus in MASK.
+ * The kernel's own threads can't be pinned this way.
+ */
+int
+sys_setaffinity(pid_t pid, uint32_t mask, int *errp)
+{
+    int result;
+
+    if (pid == 0) {
+        if (curproc == kproc) {
+            *errp = EPERM;
+            return -1;
+        }
+        result = proc_setaffinity(curproc, mask);
+    }
+    else {
+        /* Looked up and changed under the process table lock */
+        result = proc_setaffinity_pid(pid, mask);
+    }
+    if (result) {
+        *errp = result;
+        return -1;
+    }
+
+    /* Move off this cpu if we may no longer use it (PID may be us) */
+    thread_yield();
+    return 0;
+}
+
 pid_t
 sys_getpid(int *errp)
 {
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,49 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for at least the time in *USER_REQ, rounded up to whole
+ * hardclocks. Sleeps too long to count in an unsigned number of
+ * hardclocks (over a year) are cut to that. Signals don't exist to
+ * cut it short, so any time left, for *USER_REM, is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req, rem;
+	uint64_t ticks;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	/*
+	 * The first hardclock may be only a moment away, so count one
+	 * more than the request to never come back early.
+	 */
+	if ((uint64_t)req.tv_sec >= (unsigned)-1 / HZ) {
+		ticks = (unsigned)-1;
+	}
+	else {
+		ticks = (uint64_t)req.tv_sec * HZ +
+			(req.tv_nsec + 1000000000 / HZ - 1) / (1000000000 / HZ)
+			+ 1;
+	}
+	clocksleep_ticks(ticks > (unsigned)-1 ? (unsigned)-1 : ticks);
+
+	if (user_rem != NULL) {
+		rem.tv_sec = 0;
+		rem.tv_nsec = 0;
+		result = copyout(&rem, user_rem, sizeof(rem));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,174 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <stat.h>
+#include <vnode.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <limits.h>
+#include <syscall.h>
+
+/*
+ * Memory mapping system calls, for the paging VM system.
+ */
+
+#define MAP_KNOWN	(MAP_SHARED | MAP_PRIVATE | MAP_FIXED | MAP_ANON)
+#define PROT_KNOWN	(PROT_READ | PROT_WRITE | PROT_EXEC)
+
+/*
+ * Find the vnode open on FD and the length of the file.
+ */
+static
+int
+mmap_getfile(int fd, struct vnode **ret, off_t *size)
+{
+#if OPT_FILE
+	struct openfile *of;
+	struct stat st;
+	int result;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	of = curproc->p_filetable[fd];
+	if (of == NULL || of->vn == NULL) {
+		return EBADF;
+	}
+
+	result = VOP_MMAP(of->vn);
+	if (result) {
+		return result;
+	}
+	result = VOP_STAT(of->vn, &st);
+	if (result) {
+		return result;
+	}
+
+	*ret = of->vn;
+	*size = st.st_size;
+	return 0;
+#else
+	(void)fd;
+	(void)ret;
+	(void)size;
+	return EBADF;
+#endif
+}
+
+vaddr_t
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, vaddr_t sp,
+	 int *errp)
+{
+	struct vnode *vn;
+	vaddr_t vaddr;
+	off_t offset, filesize;
+	int fd, perms, result;
+
+	/*
+	 * The last two arguments didn't fit in registers. They are on the
+	 * user stack after the space set aside for the first four, with
+	 * the 64-bit offset aligned to 8 bytes.
+	 */
+	result = copyin((const_userptr_t)(sp + 16), &fd, sizeof(fd));
+	if (result == 0) {
+		result = copyin((const_userptr_t)(sp + 24), &offset, sizeof(offset));
+	}
+	if (result) {
+		*errp = result;
+		return (vaddr_t)MAP_FAILED;
+	}
+
+	vaddr = (vaddr_t)addr;
+	if (len == 0 || (flags & ~MAP_KNOWN) || (prot & ~PROT_KNOWN) ||
+	    ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0) ||
+	    ((flags & MAP_FIXED) && (vaddr & PAGE_FRAME) != vaddr)) {
+		*errp = EINVAL;
+		return (vaddr_t)MAP_FAILED;
+	}
+	/* A hint that isn't page-aligned is no use */
+	vaddr &= PAGE_FRAME;
+
+	vn = NULL;
+	filesize = 0;
+	if (flags & MAP_ANON) {
+		offset = 0;
+	}
+	else {
+		if (offset < 0 || offset % PAGE_SIZE != 0) {
+			*errp = EINVAL;
+			return (vaddr_t)MAP_FAILED;
+		}
+		result = mmap_getfile(fd, &vn, &filesize);
+		if (result) {
+			*errp = result;
+			return (vaddr_t)MAP_FAILED;
+		}
+	}
+
+	perms = ((prot & PROT_READ) ? RG_READ : 0) |
+		((prot & PROT_WRITE) ? RG_WRITE : 0) |
+		((prot & PROT_EXEC) ? RG_EXEC : 0);
+
+	result = as_mmap(proc_getas(), &vaddr, len, perms,
+			 (flags & MAP_SHARED) ? RGF_SHARED : 0,
+			 (flags & MAP_FIXED) != 0, vn, offset, filesize);
+	if (result) {
+		*errp = result;
+		return (vaddr_t)MAP_FAILED;
+	}
+
+	return vaddr;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len, int *errp)
+{
+	int result;
+
+	result = as_munmap(proc_getas(), (vaddr_t)addr, len);
+	if (result) {
+		*errp = result;
+		return -1;
+	}
+	return 0;
+}
+
+int
+sys_msync(userptr_t addr, size_t len, int flags, int *errp)
+{
+	int result;
+
+	if ((flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)) ||
+	    ((flags & MS_ASYNC) && (flags & MS_SYNC))) {
+		*errp = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * There are no other cached copies to invalidate, and writing
+	 * asynchronously isn't worth a thread; just write.
+	 */
+	result = as_msync(proc_getas(), (vaddr_t)addr, len);
+	if (result) {
+		*errp = result;
+		return -1;
+	}
+	return 0;
+}
+
+vaddr_t
+sys_sbrk(intptr_t amount, int *errp)
+{
+	vaddr_t oldbrk;
+	int result;
+
+	result = as_sbrk(proc_getas(), amount, &oldbrk);
+	if (result) {
+		*errp = result;
+		return (vaddr_t)-1;
+	}
+	return oldbrk;
+}
@@ -0,0 +1,171 @@
+/*
+ * Exec latency benchmark.
+ *
+ * Repeatedly does what runprogram does to start a program, up to the
+ * point where the program would run its first instruction: open the
+ * executable, create and activate a new address space, load_elf, set
+ * up the stack, and fetch the instruction at the entry point. Reports
+ * the average and fastest time for the whole sequence. With demand
+ * paging this should not depend on the size of the program.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <test.h>
+
+#define EB_ROUNDS	20	/* Default number of execs */
+
+struct execbench {
+	const char *eb_path;
+	unsigned eb_rounds;
+	uint64_t eb_total;	/* Nanoseconds, all rounds */
+	uint64_t eb_best;	/* Nanoseconds, fastest round */
+	int eb_result;
+	struct semaphore *eb_done;
+};
+
+/*
+ * One exec, up to the first instruction. Leaves the new address
+ * space in place for the caller to get rid of.
+ */
+static
+int
+execbench_once(const char *path)
+{
+	char pathbuf[PATH_MAX];
+	struct addrspace *as;
+	struct vnode *v;
+	vaddr_t entrypoint, stackptr;
+	uint32_t insn;
+	int result;
+
+	/* vfs_open destroys its argument */
+	strcpy(pathbuf, path);
+	result = vfs_open(pathbuf, O_RDONLY, 0, &v);
+	if (result) {
+		return result;
+	}
+
+	as = as_create();
+	if (as == NULL) {
+		vfs_close(v);
+		return ENOMEM;
+	}
+	proc_setas(as);
+	as_activate();
+
+	result = load_elf(v, &entrypoint);
+	vfs_close(v);
+	if (result) {
+		return result;
+	}
+
+	result = as_define_stack(as, &stackptr);
+	if (result) {
+		return result;
+	}
+
+	return copyin((const_userptr_t)entrypoint, &insn, sizeof(insn));
+}
+
+static
+void
+execbench_thread(void *ebp, unsigned long unused)
+{
+	struct execbench *eb = ebp;
+	struct timespec before, after, duration;
+	struct addrspace *as;
+	uint64_t nsecs;
+	unsigned i;
+
+	(void)unused;
+
+	eb->eb_result = 0;
+	eb->eb_total = 0;
+	eb->eb_best = 0;
+
+	for (i = 0; i < eb->eb_rounds && eb->eb_result == 0; i++) {
+		gettime(&before);
+		eb->eb_result = execbench_once(eb->eb_path);
+		gettime(&after);
+
+		as = proc_setas(NULL);
+		as_deactivate();
+		if (as != NULL) {
+			as_destroy(as);
+		}
+
+		timespec_sub(&after, &before, &duration);
+		nsecs = timespec_to_nsecs(&duration);
+		eb->eb_total += nsecs;
+		if (i == 0 || nsecs < eb->eb_best) {
+			eb->eb_best = nsecs;
+		}
+	}
+
+	/* Leave the process so the menu thread can destroy it */
+	proc_remthread(curthread);
+	V(eb->eb_done);
+}
+
+int
+execbench(int nargs, char **args)
+{
+	struct execbench eb;
+	struct proc *proc;
+	int result;
+
+	if (nargs < 2 || nargs > 3) {
+		kprintf("Usage: eb program [rounds]\n");
+		return EINVAL;
+	}
+	if (strlen(args[1]) >= PATH_MAX) {
+		return ENAMETOOLONG;
+	}
+
+	eb.eb_path = args[1];
+	eb.eb_rounds = (nargs == 3) ? atoi(args[2]) : EB_ROUNDS;
+	if (eb.eb_rounds == 0) {
+		eb.eb_rounds = EB_ROUNDS;
+	}
+	eb.eb_done = sem_create("execbench", 0);
+	if (eb.eb_done == NULL) {
+		return ENOMEM;
+	}
+
+	proc = proc_create_runprogram("execbench");
+	if (proc == NULL) {
+		sem_destroy(eb.eb_done);
+		return ENOMEM;
+	}
+
+	result = thread_fork("execbench", proc, execbench_thread, &eb, 0);
+	if (result) {
+		proc_destroy(proc);
+		sem_destroy(eb.eb_done);
+		return result;
+	}
+	P(eb.eb_done);
+	proc_destroy(proc);
+	sem_destroy(eb.eb_done);
+
+	if (eb.eb_result) {
+		kprintf("execbench: %s: %s\n", eb.eb_path, strerror(eb.eb_result));
+		return eb.eb_result;
+	}
+
+	kprintf("execbench: %s: %u execs, average %llu us, best %llu us\n",
+		eb.eb_path, eb.eb_rounds,
+		(unsigned long long)(eb.eb_total / eb.eb_rounds / 1000),
+		(unsigned long long)(eb.eb_best / 1000));
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * kfree latency benchmark.
+ *
+ * Grows the kernel heap step by step, up to a given size, by holding
+ * on to more and more subpage blocks, and at each step times freeing
+ * a batch of freshly allocated small blocks of all the subpage size
+ * classes. For each size class the batch has twice as many blocks as
+ * a cpu's two magazines and the depot can hold between them, so at
+ * least half the frees get past the magazines to the page level,
+ * where kfree has to find the block's page. Since it finds it through
+ * a table rather than by searching the heap, the time per kfree
+ * should stay about the same as the heap grows.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <kmalloc.h>
+#include <vm.h>
+#include <test.h>
+
+/* Sizes cycled through for the timed blocks, one per size class */
+static const size_t kb_sizes[] = { 16, 24, 48, 100, 200, 400, 800, 1500 };
+
+#define KB_MAXMB	4	/* Default heap growth, in megabytes */
+#define KB_ROUNDS	8	/* Measurements per step */
+#define KB_FILLSIZE	1024	/* Size of the blocks that grow the heap */
+
+/* Blocks freed per measurement; see above */
+#define KB_BATCH	(2 * (2 + KMAG_DEPOTMAX) * KMAG_ROUNDS * \
+			 ARRAYCOUNT(kb_sizes))
+
+/*
+ * Time freeing KB_BATCH blocks, KB_ROUNDS times over, using BATCH to
+ * hold them. Returns the average nanoseconds per kfree, or 0 if we
+ * ran out of memory.
+ */
+static
+uint64_t
+kfreebench_measure(void **batch)
+{
+	struct timespec before, after, duration;
+	uint64_t total;
+	unsigned i, j;
+
+	total = 0;
+	for (i = 0; i < KB_ROUNDS; i++) {
+		for (j = 0; j < KB_BATCH; j++) {
+			batch[j] = kmalloc(kb_sizes[j % ARRAYCOUNT(kb_sizes)]);
+			if (batch[j] == NULL) {
+				while (j > 0) {
+					kfree(batch[--j]);
+				}
+				return 0;
+			}
+		}
+
+		gettime(&before);
+		for (j = 0; j < KB_BATCH; j++) {
+			kfree(batch[j]);
+		}
+		gettime(&after);
+
+		timespec_sub(&after, &before, &duration);
+		total += timespec_to_nsecs(&duration);
+	}
+	return total / ((uint64_t)KB_ROUNDS * KB_BATCH);
+}
+
+int
+kfreebench(int nargs, char **args)
+{
+	void **fill, **batch;
+	unsigned maxmb, nfill, nheld, target, step;
+	uint64_t nsecs;
+
+	if (nargs > 2) {
+		kprintf("Usage: km [megabytes]\n");
+		return 0;
+	}
+	maxmb = (nargs == 2) ? atoi(args[1]) : KB_MAXMB;
+	if (maxmb == 0) {
+		maxmb = KB_MAXMB;
+	}
+
+	/* Four fill blocks to a heap page */
+	nfill = maxmb * 1024 * 1024 / KB_FILLSIZE;
+	fill = kmalloc(nfill * sizeof(void *));
+	batch = kmalloc(KB_BATCH * sizeof(void *));
+	if (fill == NULL || batch == NULL) {
+		kfree(fill);
+		kfree(batch);
+		kprintf("kfreebench: out of memory\n");
+		return 0;
+	}
+
+	kprintf("kfree benchmark: %u frees per step, heap grown up to %u MB\n",
+		(unsigned)(KB_BATCH * KB_ROUNDS), maxmb);
+
+	/* Steps of 0, 256K, 512K, 1M, ... */
+	nheld = 0;
+	for (step = 0; ; step++) {
+		target = (step == 0) ? 0 : (256 * 1024 / KB_FILLSIZE) << (step - 1);
+		if (target > nfill) {
+			break;
+		}
+		while (nheld < target) {
+			fill[nheld] = kmalloc(KB_FILLSIZE);
+			if (fill[nheld] == NULL) {
+				break;
+			}
+			nheld++;
+		}
+		if (nheld < target) {
+			kprintf("kfreebench: out of memory at %u KB\n",
+				nheld * KB_FILLSIZE / 1024);
+			break;
+		}
+
+		nsecs = kfreebench_measure(batch);
+		if (nsecs == 0) {
+			kprintf("kfreebench: out of memory at %u KB\n",
+				nheld * KB_FILLSIZE / 1024);
+			break;
+		}
+		kprintf("heap +%5u KB: %llu ns per kfree\n",
+			nheld * KB_FILLSIZE / 1024, (unsigned long long)nsecs);
+	}
+
+	while (nheld > 0) {
+		kfree(fill[--nheld]);
+	}
+	kfree(fill);
+	kfree(batch);
+
+	kprintf("kfreebench done\n");
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Contention benchmark for the physical page allocator.
+ *
+ * Runs 1, 2, 4, ... MAXCPUS threads at once, each repeatedly
+ * allocating and freeing a few single pages with alloc_kpages and
+ * free_kpages, and reports the aggregate throughput for each thread
+ * count. With a scalable allocator the pages per millisecond should
+ * grow roughly linearly with the number of threads, up to the number
+ * of CPUs in the machine.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <vm.h>
+#include <test.h>
+#include <platform/maxcpus.h>
+
+#define PB_ROUNDS	2000	/* Default rounds per thread */
+#define PB_HELD		4	/* Pages each thread holds at once */
+
+static unsigned pb_rounds;
+
+static
+void
+pagebenchthread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	vaddr_t pages[PB_HELD];
+	unsigned i, j;
+
+	for (i = 0; i < pb_rounds; i++) {
+		for (j = 0; j < PB_HELD; j++) {
+			pages[j] = alloc_kpages(1);
+			if (pages[j] == 0) {
+				panic("pagebench: thread %lu: out of memory\n", num);
+			}
+		}
+		for (j = 0; j < PB_HELD; j++) {
+			free_kpages(pages[j]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+pagebench(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after, duration;
+	unsigned nthreads, i;
+	unsigned long pages, msecs;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: pb [rounds]\n");
+		return 0;
+	}
+	pb_rounds = (nargs == 2) ? atoi(args[1]) : PB_ROUNDS;
+	if (pb_rounds == 0) {
+		pb_rounds = PB_ROUNDS;
+	}
+
+	sem = sem_create("pagebench", 0);
+	if (sem == NULL) {
+		panic("pagebench: sem_create failed\n");
+	}
+
+	kprintf("Page allocator benchmark: %u rounds of %u pages per thread\n",
+		pb_rounds, PB_HELD);
+
+	for (nthreads = 1; nthreads <= MAXCPUS; nthreads *= 2) {
+		gettime(&before);
+
+		for (i = 0; i < nthreads; i++) {
+			result = thread_fork("pagebench", NULL,
+					     pagebenchthread, sem, i);
+			if (result) {
+				panic("pagebench: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i = 0; i < nthreads; i++) {
+			P(sem);
+		}
+
+		gettime(&after);
+		timespec_sub(&after, &before, &duration);
+
+		pages = (unsigned long)nthreads * pb_rounds * PB_HELD;
+		msecs = duration.tv_sec * 1000 + duration.tv_nsec / 1000000;
+		kprintf("%3u threads: %lu pages in %llu.%09lu s",
+			nthreads, pages, (unsigned long long)duration.tv_sec,
+			(unsigned long)duration.tv_nsec);
+		if (msecs > 0) {
+			kprintf(", %lu pages/ms", pages / msecs);
+		}
+		kprintf("\n");
+	}
+
+	sem_destroy(sem);
+	kprintf("pagebench done\n");
+	return 0;
+}
@@ -28,8 +28,10 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <wchan.h>
 #include <synch.h>
 #include <thread.h>
 #include <current.h>
@@ -39,7 +41,7 @@
 /*
  * Unit tests for semaphores.
  *
- * We test 21 correctness criteria, each stated in a comment at the
+ * We test 23 correctness criteria, each stated in a comment at the
  * top of each test.
  *
  * Note that these tests go inside the semaphore abstraction to
@@ -818,3 +820,98 @@ semu22(int nargs, char **args)
 	panic("semu22: P tolerated null semaphore\n");
 	return 0;
 }
+
+/*
+ * 23. sem_timedP on a semaphore that nobody Vs gives up after the
+ * timeout, and not before, without changing the count and without
+ * leaving itself on the wchan.
+ */
+int
+semu23(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after, diff;
+	uint64_t msecs;
+	int result;
+
+	(void)nargs; (void)args;
+
+	sem = makesem(0);
+	kprintf("Waiting for sem_timedP to time out...\n");
+	gettime(&before);
+	result = sem_timedP(sem, HZ / 10);
+	gettime(&after);
+	KASSERT(result == ETIMEDOUT);
+
+	/* 100 ms, less at most the part of a tick already gone */
+	timespec_sub(&after, &before, &diff);
+	msecs = (uint64_t)diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+	kprintf("Waited %u ms\n", (unsigned)msecs);
+	KASSERT(msecs >= 100 - 1000 / HZ);
+
+	/* postconditions */
+	KASSERT(spinlock_not_held(&sem->sem_lock));
+	KASSERT(sem->sem_count == 0);
+	spinlock_acquire(&sem->sem_lock);
+	KASSERT(wchan_isempty(sem->sem_wchan, &sem->sem_lock));
+	spinlock_release(&sem->sem_lock);
+
+	/* a zero timeout doesn't wait at all */
+	result = sem_timedP(sem, 0);
+	KASSERT(result == ETIMEDOUT);
+
+	ok();
+	sem_destroy(sem);
+	return 0;
+}
+
+/*
+ * 24. sem_timedP returns as soon as someone Vs, well within the
+ * timeout, and takes the count.
+ */
+static
+void
+semu24_sub(void *semv, unsigned long junk)
+{
+	struct semaphore *sem = semv;
+
+	(void)junk;
+
+	clocksleep_ticks(HZ / 10);
+	V(sem);
+}
+
+int
+semu24(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after, diff;
+	int result;
+
+	(void)nargs; (void)args;
+
+	sem = makesem(0);
+	result = thread_fork("semu24_sub", NULL, semu24_sub, sem, 0);
+	if (result) {
+		panic("semu24: whoops: thread_fork failed\n");
+	}
+
+	gettime(&before);
+	result = sem_timedP(sem, 60 * HZ);
+	gettime(&after);
+	KASSERT(result == 0);
+
+	/* The V comes after 100 ms; nowhere near the timeout */
+	timespec_sub(&after, &before, &diff);
+	KASSERT(diff.tv_sec < 10);
+
+	/* postconditions */
+	KASSERT(spinlock_not_held(&sem->sem_lock));
+	KASSERT(sem->sem_count == 0);
+
+	/* clean up; give the subthread time to get out of V */
+	ok();
+	clocksleep(1);
+	sem_destroy(sem);
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Latency benchmark for TLB shootdown.
+ *
+ * For each number of target cpus from 1 up to all the others, times
+ * shootdowns of a single page, of a full batch of TLBSHOOTDOWN_MAX
+ * pages, and of a whole address space, and reports the average time
+ * from sending the IPIs to the last cpu acknowledging. The address
+ * space is a fresh one that has never run anywhere, so the targets
+ * do the full round trip but have nothing to invalidate.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <test.h>
+
+#define SB_ROUNDS	1000	/* Default shootdowns per measurement */
+#define SB_BASE		0x400000
+
+/*
+ * Average nanoseconds per shootdown of N pages on NCPUS cpus.
+ */
+static
+unsigned long
+shootbench_time(struct addrspace *as, const vaddr_t *vaddrs, unsigned n,
+		unsigned ncpus, unsigned rounds)
+{
+	struct timespec before, after, duration;
+	unsigned i;
+
+	gettime(&before);
+	for (i = 0; i < rounds; i++) {
+		vm_shootdown_ncpus(as, vaddrs, n, ncpus);
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &duration);
+
+	return timespec_to_nsecs(&duration) / rounds;
+}
+
+int
+shootbench(int nargs, char **args)
+{
+	struct addrspace *as;
+	vaddr_t vaddrs[TLBSHOOTDOWN_MAX + 1];
+	unsigned rounds, ncpus, i;
+
+	if (nargs > 2) {
+		kprintf("Usage: sb [rounds]\n");
+		return 0;
+	}
+	rounds = (nargs == 2) ? atoi(args[1]) : SB_ROUNDS;
+	if (rounds == 0) {
+		rounds = SB_ROUNDS;
+	}
+
+	if (cpu_count() < 2) {
+		kprintf("shootbench: only one cpu; nothing to measure\n");
+		return 0;
+	}
+
+	as = as_create();
+	if (as == NULL) {
+		kprintf("shootbench: as_create failed\n");
+		return 0;
+	}
+	for (i = 0; i < TLBSHOOTDOWN_MAX + 1; i++) {
+		vaddrs[i] = SB_BASE + i * PAGE_SIZE;
+	}
+
+	kprintf("TLB shootdown benchmark: %u rounds, average latency in ns\n",
+		rounds);
+	kprintf("cpus     1 page  %2u pages  whole AS\n", TLBSHOOTDOWN_MAX);
+
+	for (ncpus = 1; ncpus < cpu_count(); ncpus++) {
+		kprintf("%4u %10lu %9lu %9lu\n", ncpus,
+			shootbench_time(as, vaddrs, 1, ncpus, rounds),
+			shootbench_time(as, vaddrs, TLBSHOOTDOWN_MAX, ncpus, rounds),
+			shootbench_time(as, vaddrs, TLBSHOOTDOWN_MAX + 1, ncpus,
+					rounds));
+	}
+
+	as_destroy(as);
+	kprintf("shootbench done\n");
+	return 0;
+}
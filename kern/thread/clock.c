@@ -29,18 +29,21 @@
 
 #include <types.h>
 #include <lib.h>
+#include <kern/errno.h>
 #include <cpu.h>
 #include <wchan.h>
+#include <timer.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks scheduled for points in the future go on the per-cpu
+ * timer wheels (see timer.h), which hardclock runs; anything that
+ * sleeps for a while does so with a timer, to the nearest hardclock.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,13 +54,25 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * clocksleep sleeps here. Nothing wakes it but the sleeper's timer.
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+static struct wchan *clocksleep_wchan;
+static struct spinlock clocksleep_lock;
+
+/*
+ * Tickless idle. Once this is on, a cpu that goes idle stops its
+ * hardclock until it has something to run again; it still wakes up
+ * for interrupts, including the IPI that thread_make_runnable sends
+ * when it gives it a thread or has work for it to steal. Each time
+ * it wakes up it counts the hardclocks it would have had in the
+ * meantime, as c_wakeupsavoided, and tells its timer wheel they went
+ * by (timerwheel_skip). If it has timers pending, it sets its
+ * hardclock for when the first may be due instead of stopping it.
+ */
+static bool tickless_on;
+static struct timespec tickless_since;	/* For the rate */
 
 /*
  * Setup.
@@ -65,26 +80,24 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	spinlock_init(&clocksleep_lock);
+	clocksleep_wchan = wchan_create("clocksleep");
+	if (clocksleep_wchan == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
 	}
 }
 
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. Nothing needs it any more; timed operations use timers.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
 }
 
+static void tickless_count(struct cpu *c);
+
 /*
  * This is called HZ times a second (on each processor) by the timer
  * code.
@@ -92,18 +105,156 @@ timerclock(void)
 void
 hardclock(void)
 {
+	struct cpu *c = curcpu->c_self;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	c->c_hardclocks++;
+	if (c->c_tickless) {
+		/* A timer may be due, or the stopped clock ran all the way out */
+		tickless_count(c);
+		timerwheel_advance(&c->c_timers, 1);
+		mainbus_set_hardclock(timerwheel_next(&c->c_timers));
+		return;
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	/* This tick, plus any missed while the hardclock was stopped */
+	timerwheel_advance(&c->c_timers, 1);
+	if ((c->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_timeslice();
+}
+
+/*
+ * Count the hardclocks the current cpu would have had since it last
+ * counted, and didn't. Called with interrupts off.
+ */
+static
+void
+tickless_count(struct cpu *c)
+{
+	struct timespec now, span, counted;
+	uint64_t ticks;
+	unsigned taken;
+
+	gettime(&now);
+	timespec_sub(&now, &c->c_ticklessstart, &span);
+	ticks = timespec_to_nsecs(&span) / (1000000000 / HZ);
+	taken = c->c_hardclocks - c->c_ticklessclocks;
+	if (ticks > taken) {
+		c->c_wakeupsavoided += ticks - taken;
+		/* Timers started from now on count from after these */
+		timerwheel_skip(&c->c_timers, ticks - taken);
+	}
+
+	/* Keep the leftover part of a period for next time */
+	counted.tv_sec = ticks / HZ;
+	counted.tv_nsec = (ticks % HZ) * (1000000000 / HZ);
+	timespec_add(&c->c_ticklessstart, &counted, &c->c_ticklessstart);
+	c->c_ticklessclocks = c->c_hardclocks;
+}
+
+void
+hardclock_tickless_bootstrap(void)
+{
+	gettime(&tickless_since);
+	tickless_on = true;
+}
+
+void
+hardclock_idle(bool wakesoon)
+{
+	struct cpu *c = curcpu->c_self;
+
+	if (!tickless_on) {
+		return;
+	}
+	if (c->c_tickless) {
+		tickless_count(c);
+		if (wakesoon) {
+			c->c_tickless = false;
+			mainbus_set_hardclock(1);
+		}
+	}
+	else if (!wakesoon) {
+		gettime(&c->c_ticklessstart);
+		c->c_ticklessclocks = c->c_hardclocks;
+		c->c_tickless = true;
+		/* Until the first timer may be due; 0, none, stops it */
+		mainbus_set_hardclock(timerwheel_next(&c->c_timers));
+	}
+}
+
+void
+hardclock_resume(void)
+{
+	struct cpu *c = curcpu->c_self;
+
+	if (c->c_tickless) {
+		tickless_count(c);
+		c->c_tickless = false;
+		mainbus_set_hardclock(1);
+	}
+}
+
+void
+hardclock_printstats(void)
+{
+	struct timespec now, span;
+	unsigned i, numcpus, avoided, total;
+	uint64_t msecs;
+	struct cpu *c;
+
+	if (!tickless_on) {
+		kprintf("Tickless idle is not on yet\n");
+		return;
+	}
+
+	gettime(&now);
+	timespec_sub(&now, &tickless_since, &span);
+	msecs = (uint64_t)span.tv_sec * 1000 + span.tv_nsec / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	kprintf("Hardclocks skipped by idle cpus over %u.%03u s:\n",
+		(unsigned)(msecs / 1000), (unsigned)(msecs % 1000));
+	kprintf("    cpu %10s %10s\n", "skipped", "per sec");
+	total = 0;
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		c = cpu_get(i);
+		/* Counted when the cpu wakes up; not locked, so approximate */
+		avoided = c->c_wakeupsavoided;
+		total += avoided;
+		kprintf("    %3u %10u %10u%s\n", i, avoided,
+			(unsigned)(avoided * 1000ULL / msecs),
+			c->c_tickless ? " (tickless now)" : "");
+	}
+	kprintf("    all %10u %10u\n", total,
+		(unsigned)(total * 1000ULL / msecs));
+}
+
+/*
+ * Suspend execution for n hardclocks.
+ */
+void
+clocksleep_ticks(unsigned ticks)
+{
+	unsigned chunk;
+	int result;
+
+	spinlock_acquire(&clocksleep_lock);
+	while (ticks > 0) {
+		chunk = ticks > TIMER_MAXTICKS ? TIMER_MAXTICKS : ticks;
+		result = wchan_timedsleep(clocksleep_wchan, &clocksleep_lock,
+					  chunk);
+		KASSERT(result == ETIMEDOUT);
+		ticks -= chunk;
+	}
+	spinlock_release(&clocksleep_lock);
 }
 
 /*
@@ -112,10 +263,14 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
+	unsigned secs;
+
 	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+		secs = num_secs;
+		if (secs > TIMER_MAXTICKS / HZ) {
+			secs = TIMER_MAXTICKS / HZ;
+		}
+		clocksleep_ticks(secs * HZ);
+		num_secs -= secs;
 	}
-	spinlock_release(&lbolt_lock);
 }
@@ -121,6 +121,38 @@ spinlock_acquire(struct spinlock *splk)
 	}
 }
 
+/*
+ * Get the lock if nobody holds it, without waiting.
+ */
+bool
+spinlock_tryacquire(struct spinlock *splk)
+{
+	struct cpu *mycpu;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	if (spinlock_data_get(&splk->splk_lock) != 0 ||
+	    spinlock_data_testandset(&splk->splk_lock) != 0) {
+		spllower(IPL_HIGH, IPL_NONE);
+		return false;
+	}
+
+	membar_store_any();
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		mycpu->c_spinlocks++;
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
+	}
+	else {
+		mycpu = NULL;
+	}
+	splk->splk_holder = mycpu;
+
+	return true;
+}
+
 /*
  * Release the lock.
  */
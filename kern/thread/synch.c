@@ -33,6 +33,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
@@ -120,6 +121,37 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+sem_timedP(struct semaphore *sem, unsigned timeout)
+{
+	struct wchan_timeout wt;
+	int result;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+	if (sem->sem_count == 0 && timeout > 0) {
+		/* One deadline for however many times we're woken */
+		wchan_timeout_start(&wt, sem->sem_wchan, &sem->sem_lock,
+				    timeout);
+		while (sem->sem_count == 0 && !wchan_timeout_isdone(&wt)) {
+			wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+		}
+		wchan_timeout_stop(&wt);
+	}
+	/* If a V came in just as time ran out, take it anyway */
+	if (sem->sem_count > 0) {
+		sem->sem_count--;
+		result = 0;
+	}
+	else {
+		result = ETIMEDOUT;
+	}
+	spinlock_release(&sem->sem_lock);
+	return result;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -255,6 +287,54 @@ lock_release(struct lock *lock)
 #endif
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+#if OPT_LOCK
+        bool acquired;
+#endif
+
+        KASSERT(lock != NULL);
+
+#if OPT_LOCK
+        KASSERT(!lock_do_i_hold(lock));
+
+#if (LOCK_IMPLEMENTATION == 0)  // Implemented by Binary Semaphore
+        spinlock_acquire(&lock->lk_sem->sem_lock);
+        acquired = lock->lk_sem->sem_count > 0;
+        if (acquired) {
+                lock->lk_sem->sem_count--;
+        }
+        spinlock_release(&lock->lk_sem->sem_lock);
+        if (acquired) {
+                spinlock_acquire(&lock->lk_lock);
+                KASSERT(lock->lk_holder == NULL);
+                lock->lk_holder = curthread;
+                spinlock_release(&lock->lk_lock);
+        }
+#else                           // Implemented by Wait Channel and Spinlock
+        spinlock_acquire(&lock->lk_lock);
+        acquired = lock->lk_holder == NULL;
+        if (acquired) {
+                lock->lk_holder = curthread;
+        }
+        spinlock_release(&lock->lk_lock);
+#endif
+
+        if (acquired) {
+                /* We never waited, but hangman expects us to have */
+                HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+                HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+        }
+
+        return acquired;
+#else
+        (void)lock;
+
+        return true;
+#endif
+}
+
 bool
 lock_do_i_hold(struct lock *lock)
 {
@@ -341,6 +421,30 @@ cv_wait(struct cv *cv, struct lock *lock)
 #endif
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned timeout)
+{
+	int result;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+#if OPT_CV
+	spinlock_acquire(&cv->cv_lock);
+	lock_release(lock);
+	result = wchan_timedsleep(cv->cv_wchan, &cv->cv_lock, timeout);
+	spinlock_release(&cv->cv_lock);
+	lock_acquire(lock);
+#else
+	(void)cv;
+	(void)lock;
+	(void)timeout;
+	result = 0;
+#endif
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
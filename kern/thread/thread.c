@@ -49,12 +49,36 @@
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
+#include <clock.h>
+#include <timer.h>
 #include <vnode.h>
+#include <kmem_cache.h>
+#include "opt-paging.h"
 
+#if OPT_PAGING
+#include <coremap.h>
+#endif
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler tuning; see schedule(). A thread at level L runs for
+ * SCHED_QUANTUM(L) hardclocks before it is moved down a level.
+ */
+#define SCHED_NLEVELS		4
+#define SCHED_QUANTUM(level)	(1U << (level))
+#define SCHED_BOOST_HARDCLOCKS	100	/* Everyone back to the top, 1/s */
+
+/*
+ * A thread that stopped running on its cpu less than this many of that
+ * cpu's hardclocks ago still has its cache there; see thread_steal().
+ */
+#define STEAL_WARM_HARDCLOCKS	2
+
+/* Where thread structures come from. */
+static struct kmem_cache *thread_cache;
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -69,6 +93,10 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+static void thread_setcpu(struct thread *t, struct cpu *c);
+static void thread_switch(threadstate_t newstate, struct wchan *wc,
+			  struct spinlock *lk);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -108,6 +136,20 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Constructor for thread_cache. The list node points back at its
+ * thread, which doesn't change, and thread_destroy leaves it unlinked,
+ * so this holds for the life of the object.
+ */
+static
+void
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_init(&thread->t_listnode, thread);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -120,14 +162,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -135,10 +177,14 @@ thread_create(const char *name)
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
+	/* t_listnode was set up by thread_ctor */
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
+	thread->t_priority = 0;
+	thread->t_quantum = SCHED_QUANTUM(0);
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_lastran = 0;
 	thread->t_proc = NULL;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
@@ -176,13 +222,29 @@ cpu_create(unsigned hardware_number)
 	c->c_hardware_number = hardware_number;
 
 	c->c_curthread = NULL;
+	c->c_idlethread = NULL;
+	c->c_moving = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_tickless = false;
+	c->c_ticklessstart.tv_sec = 0;
+	c->c_ticklessstart.tv_nsec = 0;
+	c->c_ticklessclocks = 0;
+	c->c_wakeupsavoided = 0;
+	kmalloc_pcpu_init(&c->c_kmalloc);
+#if OPT_PAGING
+	coremap_pcpu_init(&c->c_coremap);
+	bzero(&c->c_tlbstats, sizeof(c->c_tlbstats));
+	c->c_tlbnext = 0;
+	c->c_asid = 0;
+	c->c_curasid = 0;
+#endif
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	timerwheel_init(&c->c_timers);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -252,6 +314,24 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Per-cpu lookup for code outside the thread system.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned software_number)
+{
+	if (software_number >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, software_number);
+}
+
 /*
  * Destroy a thread.
  *
@@ -284,7 +364,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -371,6 +451,12 @@ thread_shutdown(void)
 void
 thread_bootstrap(void)
 {
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread), 0,
+					 thread_ctor, NULL);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	cpuarray_init(&allcpus);
 
 	/*
@@ -420,6 +506,61 @@ cpu_hatch(unsigned software_number)
 	thread_exit();
 }
 
+/*
+ * A cpu's idle thread. It's never on a run queue; thread_switch picks
+ * it only when the current thread has to leave the cpu and there's
+ * nothing else to run, since the cpu can't idle on the stack of a
+ * thread that another cpu may now run. It just switches away again,
+ * and idles while looking for work like any sleeping thread.
+ */
+static
+void
+thread_idle(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		thread_switch(S_SLEEP, NULL, NULL);
+	}
+}
+
+/*
+ * Create the idle thread for cpu C. It first runs when thread_switch
+ * first switches to it.
+ */
+static
+void
+thread_idle_create(struct cpu *c)
+{
+	struct thread *t;
+	char namebuf[16];
+	int result;
+
+	snprintf(namebuf, sizeof(namebuf), "<idle #%d>", c->c_number);
+	t = thread_create(namebuf);
+	if (t == NULL) {
+		panic("thread_idle_create: Out of memory\n");
+	}
+	t->t_stack = kmalloc(STACK_SIZE);
+	if (t->t_stack == NULL) {
+		panic("thread_idle_create: Out of memory\n");
+	}
+	thread_checkstack_init(t);
+	thread_setcpu(t, c);
+	result = proc_addthread(kproc, t);
+	if (result) {
+		panic("thread_idle_create: proc_addthread: %s\n",
+		      strerror(result));
+	}
+	/* As in thread_fork, for the runqueue lock it comes out holding */
+	t->t_iplhigh_count++;
+	switchframe_init(t, thread_idle, NULL, 0);
+	t->t_state = S_SLEEP;
+	t->t_wchan_name = "idle";
+	c->c_idlethread = t;
+}
+
 /*
  * Start up secondary cpus. Called from boot().
  */
@@ -440,6 +581,112 @@ thread_start_cpus(void)
 	}
 	sem_destroy(cpu_startup_sem);
 	cpu_startup_sem = NULL;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		thread_idle_create(cpuarray_get(&allcpus, i));
+	}
+}
+
+/*
+ * Put a ready thread on a cpu's run queue, behind the threads of its
+ * own level and ahead of those of lower ones, so the run queue stays
+ * sorted by priority. The run queue lock must be held.
+ */
+static
+void
+thread_enqueue(struct cpu *c, struct thread *t)
+{
+	struct thread *prev;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	/* Most threads go at or near the end, so look from there */
+	THREADLIST_FORALL_REV(prev, c->c_runqueue) {
+		if (prev->t_priority <= t->t_priority) {
+			threadlist_insertafter(&c->c_runqueue, prev, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+/*
+ * Assign a thread that isn't running to cpu C. It has never run there,
+ * so it has nothing in C's cache to stay for.
+ */
+static
+void
+thread_setcpu(struct thread *t, struct cpu *c)
+{
+	t->t_cpu = c;
+	t->t_lastran = c->c_hardclocks - STEAL_WARM_HARDCLOCKS;
+}
+
+/*
+ * Pick up the affinity mask of a thread's process, which may have
+ * changed since the thread last looked. One word; no lock needed.
+ */
+static
+void
+thread_getaffinity(struct thread *t)
+{
+	if (t->t_proc != NULL) {
+		t->t_affinity = t->t_proc->p_affinity;
+	}
+}
+
+/*
+ * Pick a cpu for a thread that may not run on its own: the least busy
+ * of those it may run on, going by unlocked counts.
+ */
+static
+struct cpu *
+thread_affinity_cpu(struct thread *t)
+{
+	unsigned i, numcpus;
+	struct cpu *c, *best;
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!THREAD_CANRUN(t, c)) {
+			continue;
+		}
+		if (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count) {
+			best = c;
+		}
+	}
+	/* proc_setaffinity doesn't allow masks without a real cpu */
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * T was just queued on BUSY, which is running something else. Idle
+ * cpus with their hardclock stopped won't come looking for work by
+ * themselves (see thread_steal), so wake one that T may run on; it
+ * will take T, or something else from the busiest cpu, or else keep
+ * ticking until it can. Ones still ticking will look soon anyway.
+ * c_tickless is only a hint, read unlocked.
+ */
+static
+void
+thread_kick_tickless(struct thread *t, struct cpu *busy)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c->c_isidle && c->c_tickless &&
+		    THREAD_CANRUN(t, c)) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
 }
 
 /*
@@ -462,11 +709,27 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+
+		/*
+		 * If it may no longer run on its cpu, send it somewhere
+		 * it may. But not if it's still that cpu's curthread:
+		 * a thread that went to sleep stays curthread while its
+		 * cpu idles on its stack, and only that cpu can run it
+		 * then. It'll move the next time it stops running.
+		 */
+		thread_getaffinity(target);
+		if (!THREAD_CANRUN(target, targetcpu) &&
+		    targetcpu->c_curthread != target) {
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			targetcpu = thread_affinity_cpu(target);
+			thread_setcpu(target, targetcpu);
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_enqueue(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -475,12 +738,35 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!already_have_lock && !targetcpu->c_isidle) {
+		/* It has to wait; maybe an idle cpu can take it */
+		thread_kick_tickless(target, targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
+/*
+ * Send the thread this cpu just switched away from somewhere it may
+ * run, if it had to leave (see thread_switch). Called from the thread
+ * switched to, with the runqueue lock released and interrupts off.
+ * thread_make_runnable moves it now that it's no longer curthread.
+ */
+static
+void
+thread_sendoff(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_moving;
+	if (t != NULL) {
+		curcpu->c_moving = NULL;
+		thread_make_runnable(t, false);
+	}
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -518,7 +804,7 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	thread_setcpu(newthread, curthread->t_cpu);
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -547,6 +833,104 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Work stealing.
+ *
+ * A cpu that runs out of threads tries to take one from the busiest
+ * other cpu before it goes idle (see thread_switch). It does this
+ * every time it looks for work, including each time an interrupt
+ * wakes it from cpu_idle. Idle cpus normally have their hardclock
+ * stopped, so thread_make_runnable wakes one with an IPI when it
+ * queues a thread behind a running one; a cpu that finds nothing it
+ * can take yet, but might shortly, keeps its hardclock going to look
+ * again (RETRY). So a backlog on one cpu gets spread to idle ones
+ * within a tick or so, and busy cpus spend next to no time on it.
+ *
+ * The stealer looks from the tail of the victim's run queue, where the
+ * threads of the lowest level that have waited the least are; they
+ * would be the last to run there anyway. It passes over threads that
+ * may not run on the stealing cpu (t_affinity), and threads that ran
+ * on the victim within the last STEAL_WARM_HARDCLOCKS: those still
+ * have their cache there, and will likely be run again there soon
+ * enough. Once they cool off they can go. The victim's run queue lock
+ * is only tried, never waited for: if it's busy, the victim is busy
+ * too, and we'll come back soon enough. The thread counts used to
+ * choose the victim are read without locks; they only need to be
+ * roughly right.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU,
+ * which is fairly slow. But moving a cold thread that would otherwise
+ * sit waiting to an idle cpu is almost always worth it.
+ */
+static
+struct thread *
+thread_steal(bool *retry)
+{
+	unsigned i, numcpus, count, most;
+	struct cpu *c, *victim;
+	struct thread *t, *found;
+
+	*retry = false;
+	victim = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		count = c->c_runqueue.tl_count;
+		if (count > most) {
+			most = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	if (!spinlock_tryacquire(&victim->c_runqueue_lock)) {
+		*retry = true;
+		return NULL;
+	}
+	found = NULL;
+	if (!victim->c_isidle) {
+		THREADLIST_FORALL_REV(t, victim->c_runqueue) {
+			/*
+			 * If the victim went idle and then its current
+			 * thread got woken up, that thread can be on the
+			 * run queue while still being the victim's
+			 * curthread. We mustn't take it, as the victim
+			 * is still running on its stack. Checking
+			 * c_isidle above takes care of the idle part;
+			 * check anyway.
+			 */
+			if (t == victim->c_curthread ||
+			    !THREAD_CANRUN(t, curcpu)) {
+				continue;
+			}
+			if (victim->c_hardclocks - t->t_lastran <
+			    STEAL_WARM_HARDCLOCKS) {
+				/* It'll cool off in a tick or two */
+				*retry = true;
+				continue;
+			}
+			found = t;
+			break;
+		}
+	}
+	if (found != NULL) {
+		threadlist_remove(&victim->c_runqueue, found);
+		thread_setcpu(found, curcpu->c_self);
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      found->t_name, victim->c_number, curcpu->c_number);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	return found;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -561,7 +945,8 @@ static
 void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
-	struct thread *cur, *next;
+	struct thread *cur, *next, *other, *stolen;
+	bool retry;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -584,11 +969,16 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/* For thread_steal: it's been here until now */
+	cur->t_lastran = curcpu->c_hardclocks;
+	thread_getaffinity(cur);
+
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    THREAD_CANRUN(cur, curcpu)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -599,9 +989,25 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		if (!THREAD_CANRUN(cur, curcpu)) {
+			/*
+			 * Its process was pinned elsewhere. It can't go
+			 * on another cpu's run queue while we're still
+			 * on its stack, so it's sent on after the switch
+			 * (thread_sendoff).
+			 */
+			curcpu->c_moving = cur;
+			break;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		if (wc == NULL) {
+			/* The idle thread, which nothing wakes */
+			KASSERT(cur == curcpu->c_idlethread);
+			cur->t_wchan_name = "idle";
+			break;
+		}
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -642,13 +1048,73 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	curcpu->c_isidle = true;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
+		if (next == cur && newstate == S_READY) {
+			/*
+			 * We were asked to yield but are still the
+			 * best thread there is. Let the next one run
+			 * anyway, if there is one, and stay at the
+			 * front ourselves.
+			 */
+			other = threadlist_remhead(&curcpu->c_runqueue);
+			if (other != NULL) {
+				threadlist_addhead(&curcpu->c_runqueue, cur);
+				next = other;
+			}
+		}
+		if (next != NULL && next != cur) {
+			thread_getaffinity(next);
+			if (!THREAD_CANRUN(next, curcpu)) {
+				/*
+				 * Its process was pinned elsewhere since
+				 * it was queued here. It isn't running,
+				 * so send it where it may, and look
+				 * again. (If we were yielding, we're back
+				 * at the front, and run again if nothing
+				 * else is left.)
+				 */
+				spinlock_release(&curcpu->c_runqueue_lock);
+				thread_make_runnable(next, false);
+				spinlock_acquire(&curcpu->c_runqueue_lock);
+				next = NULL;
+				continue;
+			}
+		}
+		if (next == NULL && curcpu->c_moving == cur) {
+			/* Don't idle on its stack; the idle thread can */
+			KASSERT(curcpu->c_idlethread != NULL);
+			next = curcpu->c_idlethread;
+			break;
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Before going idle, see if another cpu has work */
+			stolen = thread_steal(&retry);
+			if (stolen == NULL) {
+#if OPT_PAGING
+				/*
+				 * Zero a free page for the zero pool rather
+				 * than sleep, if any still need it; one page
+				 * at a time, with interrupts on, so a thread
+				 * that becomes runnable doesn't wait long
+				 * and devices don't wait at all.
+				 */
+				if (!coremap_zero_idle()) {
+					hardclock_idle(retry);
+					cpu_idle();
+				}
+#else
+				hardclock_idle(retry);
+				cpu_idle();
+#endif
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
+			if (stolen != NULL) {
+				thread_enqueue(curcpu->c_self, stolen);
+			}
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	hardclock_resume();
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -723,6 +1189,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on the thread we switched from, if it had to leave. */
+	thread_sendoff();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -756,6 +1225,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on the thread we switched from, if it had to leave. */
+	thread_sendoff();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -786,13 +1258,9 @@ thread_exit(void)
 	 * Detach from our process. You might need to move this action
 	 * around, depending on how your wait/exit works.
 	 */
-#if OPT_WAITPID
     if (cur->t_proc != NULL) {
         proc_remthread(cur);
     }
-#else
-    proc_remthread(cur);
-#endif
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -820,139 +1288,135 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each thread has a priority
+ * level, 0 being the highest, and each cpu's run queue is kept sorted
+ * by level (see thread_enqueue), so the next thread to run is always
+ * the first one of the highest level that has any, and threads of one
+ * level take turns.
+ *
+ *    - A new thread starts at level 0.
+ *
+ *    - A thread at level L gets SCHED_QUANTUM(L) hardclocks of cpu
+ *      time. When it has used them all it moves down a level and, if
+ *      a thread of its new level or better is waiting, gives way to
+ *      it (thread_timeslice). Lower levels get longer quanta, so
+ *      cpu-bound threads sink and then switch less often.
+ *
+ *    - A thread that wakes up from wchan_sleep moves up a level
+ *      (thread_wakeup_boost), so threads that mostly wait for I/O or
+ *      each other stay near the top and run soon after they wake.
+ *
+ *    - A waiting thread of a higher level than the running one takes
+ *      over at the next hardclock.
+ *
+ *    - A thread whose process was pinned away from the cpu it's on
+ *      (t_affinity) gives way at the next hardclock if anything else
+ *      is waiting there, and is sent to a cpu it may use the next
+ *      time that cpu looks for a thread to run (thread_switch).
+ *
+ *    - Every SCHED_BOOST_HARDCLOCKS this cpu's threads all go back
+ *      to level 0 (schedule), so that a steady stream of
+ *      high-priority work can't starve the low levels forever, and
+ *      threads that have stopped hogging the cpu recover.
+ *
+ * Levels are per thread and run queues per cpu, so migration only
+ * has to keep each queue sorted when it moves threads.
  */
 
+/*
+ * Raise a thread that is waking up by a level, with a fresh quantum.
+ * It must not be on a run queue yet.
+ */
+static
 void
-schedule(void)
+thread_wakeup_boost(struct thread *t)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	if (t->t_priority > 0) {
+		t->t_priority--;
+	}
+	t->t_quantum = SCHED_QUANTUM(t->t_priority);
 }
 
-/*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
- */
 void
-thread_consider_migration(void)
+thread_timeslice(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *cur, *next;
+	bool expired, preempt;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+	if (curcpu->c_isidle) {
+		/* Nothing to charge; thread_switch would return anyway */
+		return;
+	}
+
+	cur = curthread;
+	thread_getaffinity(cur);
+	KASSERT(cur->t_quantum > 0);
+	cur->t_quantum--;
+	expired = (cur->t_quantum == 0);
+	if (expired) {
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	/*
+	 * If our process was pinned elsewhere while we were running,
+	 * move now, even if nothing else wants this cpu; thread_switch
+	 * hands us on to a cpu we may use.
+	 */
+	if (!THREAD_CANRUN(cur, curcpu)) {
+		thread_yield();
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	/*
+	 * With nothing else waiting there's nothing to decide, so don't
+	 * bother with the lock. This looks unlocked; a thread queued
+	 * just now gets considered at the next hardclock.
+	 */
+	if (threadlist_isempty(&curcpu->c_runqueue)) {
+		return;
 	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	next = threadlist_peekhead(&curcpu->c_runqueue);
+	preempt = next != NULL &&
+		(next->t_priority < cur->t_priority ||
+		 (expired && next->t_priority == cur->t_priority));
 	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+	if (preempt) {
+		thread_yield();
+	}
+}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
-		spinlock_release(&c->c_runqueue_lock);
+/*
+ * This is called periodically from hardclock(). Every
+ * SCHED_BOOST_HARDCLOCKS it puts all of this cpu's threads back at
+ * level 0. That doesn't change the order of the run queue, since it
+ * was sorted and everything in it is now the same level.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+
+	if (curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS != 0) {
+		return;
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	THREADLIST_FORALL(t, curcpu->c_runqueue) {
+		t->t_priority = 0;
+		t->t_quantum = SCHED_QUANTUM(0);
 	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_quantum = SCHED_QUANTUM(0);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -1044,6 +1508,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_wakeup_boost(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1074,12 +1539,110 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeup_boost(target);
 		thread_make_runnable(target, false);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Timer function for wchan_timeout_start: time's up. If the thread is
+ * still asleep on the channel, wake it. The channel is scanned for
+ * it, which is fine as long as channels don't get long.
+ */
+static
+void
+wchan_timeout_expire(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct wchan *wc = wt->wt_wchan;
+	struct thread *target;
+
+	spinlock_acquire(wt->wt_lock);
+	THREADLIST_FORALL(target, wc->wc_threads) {
+		if (target == wt->wt_thread) {
+			/*
+			 * Only if we're the ones waking it; if it was
+			 * woken already, that wakeup mustn't be lost.
+			 */
+			wt->wt_expired = true;
+			threadlist_remove(&wc->wc_threads, target);
+			thread_wakeup_boost(target);
+			thread_make_runnable(target, false);
+			break;
+		}
+	}
+	/* Once this lets go, WT may be gone; don't touch it again */
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Set a timer to wake the current thread from WC after TICKS
+ * hardclocks. LK must be held.
+ */
+void
+wchan_timeout_start(struct wchan_timeout *wt, struct wchan *wc,
+		    struct spinlock *lk, unsigned ticks)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+
+	wt->wt_wchan = wc;
+	wt->wt_lock = lk;
+	wt->wt_thread = curthread;
+	wt->wt_expired = false;
+	timer_init(&wt->wt_timer, wchan_timeout_expire, wt);
+	timer_start(&wt->wt_timer, ticks);
+}
+
+/*
+ * Check if time is up, whether or not the timer woke us. LK must be
+ * held. The timer's function takes LK before waking anyone, so if
+ * it's still to run, we'll be on WC by the time it does.
+ */
+bool
+wchan_timeout_isdone(struct wchan_timeout *wt)
+{
+	KASSERT(spinlock_do_i_hold(wt->wt_lock));
+
+	return wt->wt_expired || !timer_pending(&wt->wt_timer);
+}
+
+/*
+ * Make sure a wchan_timeout won't go off. LK must be held; it's
+ * dropped and retaken if the timer might be going off right now,
+ * since its function then needs LK to finish.
+ */
+void
+wchan_timeout_stop(struct wchan_timeout *wt)
+{
+	KASSERT(spinlock_do_i_hold(wt->wt_lock));
+
+	if (wt->wt_expired) {
+		/* Its function may be returning, but is done with LK */
+		timer_stop(&wt->wt_timer);
+		return;
+	}
+	spinlock_release(wt->wt_lock);
+	timer_stop(&wt->wt_timer);
+	spinlock_acquire(wt->wt_lock);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks. Returns 0 if
+ * woken up, or ETIMEDOUT.
+ */
+int
+wchan_timedsleep(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timeout wt;
+
+	wchan_timeout_start(&wt, wc, lk, ticks);
+	wchan_sleep(wc, lk);
+	wchan_timeout_stop(&wt);
+	return wt.wt_expired ? ETIMEDOUT : 0;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1138,12 +1701,22 @@ ipi_broadcast(int code)
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	unsigned n;
+	ipi_tlbshootdown_batch(target, mapping, 1);
+}
+
+/*
+ * Send several TLB shootdowns to the specified CPU with one IPI.
+ */
+void
+ipi_tlbshootdown_batch(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned i, m;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	m = target->c_numshootdown;
+	if (n > TLBSHOOTDOWN_MAX - m) {
 		/*
 		 * If you have problems with this panic going off,
 		 * consider: (1) increasing the maximum, (2) putting
@@ -1155,10 +1728,10 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 		 */
 		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
 	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	for (i=0; i<n; i++) {
+		target->c_shootdown[m + i] = mappings[i];
 	}
+	target->c_numshootdown = m + n;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
@@ -1172,6 +1745,8 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 void
 interprocessor_interrupt(void)
 {
+	struct tlbshootdown shootdown[TLBSHOOTDOWN_MAX];
+	unsigned numshootdown = 0;
 	uint32_t bits;
 	unsigned i;
 
@@ -1203,16 +1778,23 @@ interprocessor_interrupt(void)
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
-		 * Note: depending on your VM system locking you might
-		 * need to release the ipi lock while calling
-		 * vm_tlbshootdown.
+		 * Take the requests off the queue and do them after
+		 * releasing the ipi lock: vm_tlbshootdown may wake up
+		 * a thread waiting for the shootdown, which takes a
+		 * runqueue lock, and thread_make_runnable holds a
+		 * runqueue lock while it takes ipi locks.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		numshootdown = curcpu->c_numshootdown;
+		for (i=0; i<numshootdown; i++) {
+			shootdown[i] = curcpu->c_shootdown[i];
 		}
 		curcpu->c_numshootdown = 0;
 	}
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	for (i=0; i<numshootdown; i++) {
+		vm_tlbshootdown(&shootdown[i]);
+	}
 }
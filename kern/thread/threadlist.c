@@ -197,6 +197,15 @@ threadlist_remhead(struct threadlist *tl)
 	return tln->tln_self;
 }
 
+struct thread *
+threadlist_peekhead(struct threadlist *tl)
+{
+	DEBUGASSERT(tl != NULL);
+
+	/* the tail sentinel's tln_self is NULL, so this is NULL if empty */
+	return tl->tl_head.tln_next->tln_self;
+}
+
 struct thread *
 threadlist_remtail(struct threadlist *tl)
 {
@@ -0,0 +1,281 @@
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <timer.h>
+
+/*
+ * Kernel timers. See timer.h.
+ *
+ * A timer due DELTA ticks after the wheel's next tick goes on the
+ * lowest level whose turn covers DELTA, in the slot for the relevant
+ * bits of its expiry time. When level 0 wraps round to slot 0, the
+ * current slot of level 1 is emptied back into the wheel, which puts
+ * its timers on level 0 since they're now due within one turn; and
+ * when level 1 wraps, likewise level 2, and so on.
+ */
+
+#define TIMER_MASK	(TIMER_WHEELSIZE - 1)
+
+/*
+ * Slot list manipulation. Called with tw_lock held.
+ */
+static
+void
+timer_link(struct timer **slot, struct timer *tm)
+{
+	tm->tm_slot = slot;
+	tm->tm_prev = NULL;
+	tm->tm_next = *slot;
+	if (*slot != NULL) {
+		(*slot)->tm_prev = tm;
+	}
+	*slot = tm;
+}
+
+static
+void
+timer_unlink(struct timer *tm)
+{
+	if (tm->tm_prev != NULL) {
+		tm->tm_prev->tm_next = tm->tm_next;
+	}
+	else {
+		KASSERT(*tm->tm_slot == tm);
+		*tm->tm_slot = tm->tm_next;
+	}
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prev = tm->tm_prev;
+	}
+	tm->tm_next = tm->tm_prev = NULL;
+	tm->tm_slot = NULL;
+}
+
+/*
+ * Put a timer in the slot its expiry time calls for.
+ */
+static
+void
+timerwheel_add(struct timerwheel *tw, struct timer *tm)
+{
+	unsigned delta, level, idx;
+
+	delta = tm->tm_expires - tw->tw_now;
+	KASSERT(delta <= TIMER_MAXTICKS);
+	for (level = 0; level < TIMER_LEVELS - 1; level++) {
+		if (delta < (1U << ((level + 1) * TIMER_WHEELBITS))) {
+			break;
+		}
+	}
+	idx = (tm->tm_expires >> (level * TIMER_WHEELBITS)) & TIMER_MASK;
+	timer_link(&tw->tw_slots[level][idx], tm);
+}
+
+/*
+ * Run one tick: cascade if level 0 wrapped, then call the functions
+ * of the timers due. They're moved off the wheel first, so that one
+ * started by a function, even for a whole turn from now, waits for
+ * its turn. Called with tw_lock held; drops it around each function.
+ */
+static
+void
+timerwheel_tick(struct timerwheel *tw)
+{
+	struct timer *tm, **slot;
+	void (*func)(void *);
+	void *data;
+	unsigned level, idx;
+
+	if ((tw->tw_now & TIMER_MASK) == 0) {
+		for (level = 1; level < TIMER_LEVELS; level++) {
+			idx = (tw->tw_now >> (level * TIMER_WHEELBITS)) & TIMER_MASK;
+			slot = &tw->tw_slots[level][idx];
+			while ((tm = *slot) != NULL) {
+				timer_unlink(tm);
+				timerwheel_add(tw, tm);
+			}
+			if (idx != 0) {
+				break;
+			}
+		}
+	}
+
+	slot = &tw->tw_slots[0][tw->tw_now & TIMER_MASK];
+	while ((tm = *slot) != NULL) {
+		timer_unlink(tm);
+		timer_link(&tw->tw_expired, tm);
+	}
+	tw->tw_now++;
+
+	while ((tm = tw->tw_expired) != NULL) {
+		timer_unlink(tm);
+		tw->tw_count--;
+		func = tm->tm_func;
+		data = tm->tm_data;
+		tw->tw_running = tm;
+		spinlock_release(&tw->tw_lock);
+
+		func(data);
+
+		spinlock_acquire(&tw->tw_lock);
+		tw->tw_running = NULL;
+	}
+}
+
+void
+timer_init(struct timer *tm, void (*func)(void *data), void *data)
+{
+	tm->tm_next = tm->tm_prev = NULL;
+	tm->tm_slot = NULL;
+	tm->tm_expires = 0;
+	tm->tm_wheel = NULL;
+	tm->tm_func = func;
+	tm->tm_data = data;
+}
+
+void
+timer_start(struct timer *tm, unsigned ticks)
+{
+	struct timerwheel *tw;
+	unsigned delta;
+	int spl;
+
+	KASSERT(tm->tm_slot == NULL);
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	if (ticks > TIMER_MAXTICKS) {
+		ticks = TIMER_MAXTICKS;
+	}
+
+	/* Interrupts off first, so we can't move to another cpu */
+	spl = splhigh();
+	tw = &curcpu->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+	tm->tm_wheel = tw;
+	/* Count from now, not from the last tick the wheel ran */
+	delta = tw->tw_lag + ticks - 1;
+	if (delta > TIMER_MAXTICKS) {
+		delta = TIMER_MAXTICKS;
+	}
+	tm->tm_expires = tw->tw_now + delta;
+	timerwheel_add(tw, tm);
+	tw->tw_count++;
+	spinlock_release(&tw->tw_lock);
+	splx(spl);
+}
+
+bool
+timer_stop(struct timer *tm)
+{
+	struct timerwheel *tw;
+
+	tw = tm->tm_wheel;
+	if (tw == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tm->tm_slot != NULL) {
+		timer_unlink(tm);
+		tw->tw_count--;
+		spinlock_release(&tw->tw_lock);
+		return true;
+	}
+	while (tw->tw_running == tm) {
+		/* Its function is running on the wheel's cpu; wait it out */
+		spinlock_release(&tw->tw_lock);
+		spinlock_acquire(&tw->tw_lock);
+	}
+	spinlock_release(&tw->tw_lock);
+	return false;
+}
+
+bool
+timer_pending(struct timer *tm)
+{
+	return tm->tm_slot != NULL;
+}
+
+void
+timerwheel_init(struct timerwheel *tw)
+{
+	unsigned level, idx;
+
+	spinlock_init(&tw->tw_lock);
+	tw->tw_now = 0;
+	tw->tw_lag = 0;
+	tw->tw_count = 0;
+	tw->tw_expired = NULL;
+	tw->tw_running = NULL;
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		for (idx = 0; idx < TIMER_WHEELSIZE; idx++) {
+			tw->tw_slots[level][idx] = NULL;
+		}
+	}
+}
+
+void
+timerwheel_advance(struct timerwheel *tw, unsigned nticks)
+{
+	spinlock_acquire(&tw->tw_lock);
+	nticks += tw->tw_lag;
+	tw->tw_lag = 0;
+	while (nticks > 0) {
+		if (tw->tw_count == 0) {
+			/* Nothing to run or cascade; just move the clock */
+			tw->tw_now += nticks;
+			break;
+		}
+		timerwheel_tick(tw);
+		nticks--;
+	}
+	spinlock_release(&tw->tw_lock);
+}
+
+void
+timerwheel_skip(struct timerwheel *tw, unsigned nticks)
+{
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		/* Nothing they'd run or cascade; move the clock past them */
+		tw->tw_now += tw->tw_lag + nticks;
+		tw->tw_lag = 0;
+	}
+	else {
+		tw->tw_lag += nticks;
+	}
+	spinlock_release(&tw->tw_lock);
+}
+
+unsigned
+timerwheel_next(struct timerwheel *tw)
+{
+	unsigned idx, i, next;
+
+	spinlock_acquire(&tw->tw_lock);
+	idx = tw->tw_now & TIMER_MASK;
+	if (tw->tw_count == 0) {
+		next = 0;
+	}
+	else if (idx == 0) {
+		/* The next tick cascades, and may bring anything down */
+		next = 1;
+	}
+	else {
+		/* The first full slot this turn, else the next cascade */
+		next = TIMER_WHEELSIZE - idx + 1;
+		for (i = idx; i < TIMER_WHEELSIZE; i++) {
+			if (tw->tw_slots[0][i] != NULL) {
+				next = i - idx + 1;
+				break;
+			}
+		}
+		/* Allow for the ticks already gone by */
+		next = next > tw->tw_lag ? next - tw->tw_lag : 1;
+	}
+	spinlock_release(&tw->tw_lock);
+	return next;
+}
@@ -34,8 +34,11 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
+#include <uio.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <pagecache.h>
+#include "opt-paging.h"
 
 /*
  * Initialize an abstract vnode.
@@ -52,6 +55,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	vn->vn_pagecache = NULL;
 	return 0;
 }
 
@@ -63,6 +67,12 @@ vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
 
+#if OPT_PAGING
+	/* vnode_decref wrote the pages back before VOP_RECLAIM */
+	pagecache_purge(vn);
+#endif
+	KASSERT(vn->vn_pagecache == NULL);
+
 	spinlock_cleanup(&vn->vn_countlock);
 
 	vn->vn_ops = NULL;
@@ -72,6 +82,46 @@ vnode_cleanup(struct vnode *vn)
 }
 
 
+/*
+ * Write to a file, and bring any pages of it the page cache has up
+ * to date, so shared mappings see the write. Called by VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+#if OPT_PAGING
+	off_t start = uio->uio_offset;
+#endif
+
+	result = __VOP(vn, write)(vn, uio);
+#if OPT_PAGING
+	/* Even after an error, for whatever part got written */
+	if (vn->vn_pagecache != NULL && uio->uio_offset > start) {
+		pagecache_update(vn, start, uio->uio_offset - start);
+	}
+#endif
+	return result;
+}
+
+/*
+ * Change a file's size, and cut its cached pages to match. Called by
+ * VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, pos);
+#if OPT_PAGING
+	if (result == 0 && vn->vn_pagecache != NULL) {
+		pagecache_truncate(vn, pos);
+	}
+#endif
+	return result;
+}
+
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
@@ -113,6 +163,18 @@ vnode_decref(struct vnode *vn)
 	spinlock_release(&vn->vn_countlock);
 
 	if (destroy) {
+#if OPT_PAGING
+		/*
+		 * Nobody maps it any more, but something may not be
+		 * written. Do it now, before the filesystem syncs the
+		 * inode (or frees it) in VOP_RECLAIM.
+		 */
+		result = pagecache_flush(vn);
+		if (result) {
+			kprintf("vfs: Warning: pagecache_flush: %s\n",
+				strerror(result));
+		}
+#endif
 		result = VOP_RECLAIM(vn);
 		if (result != 0 && result != EBUSY) {
 			// XXX: lame.
@@ -27,12 +27,20 @@
  * SUCH DAMAGE.
  */
 
+#define ADDRSPACEINLINE
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <pagecache.h>
+#include <swap.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -40,6 +48,26 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+/*
+ * User stack sizes, in pages. The stack region starts out
+ * VM_STACKINIT pages long and grows on demand up to the stack limit,
+ * which can be set anywhere from VM_STACKMIN, enough for an argument
+ * block of size ARG_MAX, to VM_STACKMAX.
+ */
+#define VM_STACKINIT     2
+#define VM_STACKMIN      18
+#define VM_STACKMAX      2048
+#define VM_STACKDEFAULT  256
+
+/*
+ * mmap places mappings from here down, leaving room for the largest
+ * stack plus an unmapped guard page below it. The heap stops here
+ * too.
+ */
+#define VM_MMAPTOP       (USERSTACK - (VM_STACKMAX + 1) * PAGE_SIZE)
+
+static unsigned as_stacklimit = VM_STACKDEFAULT;
+
 struct addrspace *
 as_create(void)
 {
@@ -50,17 +78,234 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	regionarray_init(&as->as_regions);
+	as->as_loading = false;
+	bzero(as->as_asid, sizeof(as->as_asid));
+	as->as_heap = NULL;
+	as->as_brk = 0;
+	as->as_stack = NULL;
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		regionarray_cleanup(&as->as_regions);
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt);
+		regionarray_cleanup(&as->as_regions);
+		kfree(as);
+		return NULL;
+	}
 
 	return as;
 }
 
+/*
+ * Add a region to AS. The caller must hold as_lock.
+ */
+static
+int
+as_add_region(struct addrspace *as, vaddr_t base, size_t npages, int perms)
+{
+	struct region *rg;
+	int result;
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_base = base;
+	rg->rg_npages = npages;
+	rg->rg_perms = perms;
+	rg->rg_flags = 0;
+	rg->rg_vnode = NULL;
+	rg->rg_filebase = base;
+	rg->rg_filesize = 0;
+	rg->rg_offset = 0;
+
+	result = regionarray_add(&as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+
+	return 0;
+}
+
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned i, num;
+
+	num = regionarray_num(&as->as_regions);
+	for (i = 0; i < num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (vaddr >= rg->rg_base &&
+		    vaddr - rg->rg_base < rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+
+	return NULL;
+}
+
+int
+as_map_file(struct addrspace *as, vaddr_t vaddr, size_t filesize,
+	    struct vnode *v, off_t offset)
+{
+	struct region *rg;
+
+	if (filesize == 0) {
+		return 0;
+	}
+
+	lock_acquire(as->as_lock);
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL || rg->rg_vnode != NULL ||
+	    filesize > rg->rg_npages * PAGE_SIZE - (vaddr - rg->rg_base)) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_filebase = vaddr;
+	rg->rg_filesize = filesize;
+	rg->rg_offset = offset;
+
+	lock_release(as->as_lock);
+
+	return 0;
+}
+
+/*
+ * pt_walk callback for as_copy: share one resident page between the
+ * old and new address space. Both copies become copy-on-write, and
+ * vm_fault gives each side its own frame when it first writes.
+ *
+ * Pages that are out in swap are read back into a private frame for
+ * the new address space instead.
+ */
+static
+int
+as_share_page(vaddr_t vaddr, pte_t *pte, void *data)
+{
+	struct addrspace *newas = data;
+	pte_t *newpte;
+	paddr_t paddr;
+	int result;
+
+	if (!(*pte & (PTE_VALID | PTE_SWAP))) {
+		return 0;
+	}
+
+	newpte = pt_lookup(newas->as_pt, vaddr, true);
+	if (newpte == NULL) {
+		return ENOMEM;
+	}
+
+	if (*pte & PTE_SWAP) {
+		paddr = coremap_alloc_upage(newas, vaddr);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = swap_in(PTE_SLOT(*pte), paddr);
+		if (result) {
+			coremap_free(paddr);
+			return result;
+		}
+		/* The slot belongs to the old page */
+		coremap_setdirty(paddr);
+		*newpte = paddr | PTE_VALID;
+		return 0;
+	}
+
+	coremap_incref(*pte & PTE_FRAME);
+	*pte = (*pte & ~(pte_t)PTE_WRITE) | PTE_COW;
+	*newpte = *pte;
+
+	return 0;
+}
+
+/*
+ * Share the pages of a MAP_SHARED region RG of OLD with NEWAS, without
+ * copy-on-write: both keep using the same frames. File pages nobody
+ * has touched yet will come from the page cache for both. Anonymous
+ * pages have nowhere else to come from, so they are all brought into
+ * memory first.
+ */
+static
+int
+as_share_region(struct addrspace *old, struct addrspace *newas,
+		struct region *rg)
+{
+	pte_t *pte, *newpte;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	size_t i;
+	int result;
+
+	for (i = 0; i < rg->rg_npages; i++) {
+		vaddr = rg->rg_base + i * PAGE_SIZE;
+
+		pte = pt_lookup(old->as_pt, vaddr, rg->rg_vnode == NULL);
+		if (pte == NULL) {
+			if (rg->rg_vnode != NULL) {
+				continue;
+			}
+			return ENOMEM;
+		}
+
+		if (*pte & PTE_SWAP) {
+			KASSERT(rg->rg_vnode == NULL);
+			paddr = coremap_alloc_upage(old, vaddr);
+			if (paddr == 0) {
+				return ENOMEM;
+			}
+			result = swap_in(PTE_SLOT(*pte), paddr);
+			if (result) {
+				coremap_free(paddr);
+				return result;
+			}
+			swap_free(PTE_SLOT(*pte));
+			coremap_setdirty(paddr);
+			*pte = paddr | PTE_VALID;
+		}
+		else if (!(*pte & PTE_VALID)) {
+			if (rg->rg_vnode != NULL) {
+				continue;
+			}
+			paddr = coremap_alloc_upage(old, vaddr);
+			if (paddr == 0) {
+				return ENOMEM;
+			}
+			bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+			*pte = paddr | PTE_VALID;
+		}
+
+		newpte = pt_lookup(newas->as_pt, vaddr, true);
+		if (newpte == NULL) {
+			return ENOMEM;
+		}
+		coremap_incref(*pte & PTE_FRAME);
+		*newpte = *pte;
+	}
+
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg, *newrg;
+	unsigned i, num;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
@@ -68,21 +313,141 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	}
 
 	/*
-	 * Write this.
+	 * Nobody else can see the new address space yet, but the page
+	 * evictor could try to take its pages as soon as they exist.
 	 */
+	lock_acquire(old->as_lock);
+	lock_acquire(newas->as_lock);
+
+	result = 0;
+	num = regionarray_num(&old->as_regions);
+	for (i = 0; i < num && result == 0; i++) {
+		rg = regionarray_get(&old->as_regions, i);
+		result = as_add_region(newas, rg->rg_base, rg->rg_npages,
+				       rg->rg_perms);
+		if (result) {
+			break;
+		}
+		newrg = regionarray_get(&newas->as_regions, i);
+		newrg->rg_flags = rg->rg_flags;
+		if (rg == old->as_heap) {
+			newas->as_heap = newrg;
+			newas->as_brk = old->as_brk;
+		}
+		if (rg == old->as_stack) {
+			newas->as_stack = newrg;
+		}
+		if (rg->rg_vnode != NULL) {
+			/* Pages not read in yet come from the same file */
+			VOP_INCREF(rg->rg_vnode);
+			newrg->rg_vnode = rg->rg_vnode;
+			newrg->rg_filebase = rg->rg_filebase;
+			newrg->rg_filesize = rg->rg_filesize;
+			newrg->rg_offset = rg->rg_offset;
+		}
+
+		if (rg->rg_flags & RGF_SHARED) {
+			result = as_share_region(old, newas, rg);
+		}
+		else {
+			result = pt_walk(old->as_pt, rg->rg_base,
+					 rg->rg_base + rg->rg_npages * PAGE_SIZE,
+					 as_share_page, newas);
+		}
+	}
 
-	(void)old;
+	lock_release(newas->as_lock);
+	lock_release(old->as_lock);
+
+	/*
+	 * Pages we just shared may still be mapped writeable in the TLB
+	 * for the old address space, on any cpu it has run on; make the
+	 * next write to them fault.
+	 */
+	if (old == proc_getas()) {
+		vmtlb_forget(old);
+	}
+
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
 }
 
+/*
+ * pt_walk callback for as_destroy and as_munmap: release one page, in
+ * memory or in swap. as_munmap has already cleared PTE_VALID, but the
+ * frame is still there.
+ */
+static
+int
+as_free_page(vaddr_t vaddr, pte_t *pte, void *data)
+{
+	(void)vaddr;
+	(void)data;
+
+	if (*pte & PTE_SWAP) {
+		swap_free(PTE_SLOT(*pte));
+	}
+	else if (*pte & PTE_FRAME) {
+		coremap_free(*pte & PTE_FRAME);
+	}
+	*pte = 0;
+
+	return 0;
+}
+
+/*
+ * Write back what shared mapping RG changed in [START, END) to its file.
+ */
+static
+int
+as_writeback(struct region *rg, vaddr_t start, vaddr_t end)
+{
+	unsigned index;
+
+	if (!(rg->rg_flags & RGF_SHARED) || rg->rg_vnode == NULL ||
+	    !(rg->rg_perms & RG_WRITE)) {
+		return 0;
+	}
+	index = (rg->rg_offset + (start - rg->rg_filebase)) / PAGE_SIZE;
+	return pagecache_writeback(rg->rg_vnode, index,
+				   (end - start) / PAGE_SIZE);
+}
+
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct region *rg;
+	unsigned i;
+
+	lock_acquire(as->as_lock);
+	pt_walk(as->as_pt, 0, USERSPACETOP, as_free_page, NULL);
+	lock_release(as->as_lock);
+
+	pt_destroy(as->as_pt);
+
+	for (i = regionarray_num(&as->as_regions); i > 0; i--) {
+		rg = regionarray_get(&as->as_regions, i - 1);
+		/*
+		 * The page cache still holds the frames we just let go of,
+		 * and never drops a dirty one while we hold the vnode; with
+		 * our references gone this makes them clean, as in
+		 * as_munmap. Nobody to report a failure to.
+		 */
+		as_writeback(rg, rg->rg_base, rg->rg_base + rg->rg_npages * PAGE_SIZE);
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+		regionarray_remove(&as->as_regions, i - 1);
+	}
+	regionarray_cleanup(&as->as_regions);
+
+	lock_destroy(as->as_lock);
 
 	kfree(as);
 }
@@ -101,78 +466,163 @@ as_activate(void)
 		return;
 	}
 
-	/*
-	 * Write this.
-	 */
+	vmtlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do: entries left in the TLB are tagged with this
+	 * address space's ID and won't match for anyone else.
 	 */
 }
 
+/*
+ * True if no region overlaps [VADDR, VADDR+LEN). The caller must hold
+ * as_lock.
+ */
+static
+bool
+as_range_free(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	unsigned i, num;
+
+	if (vaddr == 0 || vaddr + len > USERSPACETOP || vaddr + len < vaddr) {
+		return false;
+	}
+
+	num = regionarray_num(&as->as_regions);
+	for (i = 0; i < num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (vaddr < rg->rg_base + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_base < vaddr + len) {
+			return false;
+		}
+	}
+	return true;
+}
+
 /*
  * Set up a segment at virtual address VADDR of size MEMSIZE. The
  * segment in memory extends from VADDR up to (but not including)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Writes
+ * to a segment that isn't writeable fault once loading is complete;
+ * the other two are recorded but not enforced, since the MIPS TLB
+ * can't.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+	size_t npages;
+	int result;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = memsize / PAGE_SIZE;
+	if (npages == 0) {
+		return 0;
+	}
+
+	if (vaddr + memsize > USERSPACETOP || vaddr + memsize < vaddr) {
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+
+	if (!as_range_free(as, vaddr, memsize)) {
+		/* Overlaps a region, possibly swallowing it whole */
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	result = as_add_region(as, vaddr, npages,
+			       (readable ? RG_READ : 0) |
+			       (writeable ? RG_WRITE : 0) |
+			       (executable ? RG_EXEC : 0));
+
+	lock_release(as->as_lock);
+
+	return result;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	/* Let load_elf write into read-only segments. */
+	lock_acquire(as->as_lock);
+	as->as_loading = true;
+	lock_release(as->as_lock);
 
-	(void)as;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+	vaddr_t heapbase;
+	unsigned i, num;
+	int result;
+
+	lock_acquire(as->as_lock);
+	as->as_loading = false;
+
+	/* Start an empty heap right after the highest segment */
+	if (as->as_heap == NULL) {
+		heapbase = 0;
+		num = regionarray_num(&as->as_regions);
+		for (i = 0; i < num; i++) {
+			rg = regionarray_get(&as->as_regions, i);
+			if (rg->rg_base + rg->rg_npages * PAGE_SIZE > heapbase) {
+				heapbase = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+			}
+		}
+		result = as_add_region(as, heapbase, 0, RG_READ | RG_WRITE);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+		as->as_heap = regionarray_get(&as->as_regions, num);
+		as->as_heap->rg_flags = RGF_HEAP;
+		as->as_brk = heapbase;
+	}
+
+	lock_release(as->as_lock);
+
+	/* Drop the writeable mappings made while loading. */
+	if (as == proc_getas()) {
+		vmtlb_forget(as);
+	}
 
-	(void)as;
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
 
-	(void)as;
+	lock_acquire(as->as_lock);
+	KASSERT(as->as_stack == NULL);
+	result = as_add_region(as, USERSTACK - VM_STACKINIT * PAGE_SIZE,
+			       VM_STACKINIT, RG_READ | RG_WRITE);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	as->as_stack = as_find_region(as, USERSTACK - PAGE_SIZE);
+	lock_release(as->as_lock);
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -180,3 +630,350 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Find room for LEN bytes of mappings, as high up as possible below
+ * VM_MMAPTOP. Returns 0 if there is none. The caller must hold
+ * as_lock.
+ */
+static
+vaddr_t
+as_find_space(struct addrspace *as, size_t len)
+{
+	struct region *rg;
+	vaddr_t end;
+	unsigned i, num;
+
+	end = VM_MMAPTOP;
+	num = regionarray_num(&as->as_regions);
+ again:
+	if (len > end - PAGE_SIZE) {
+		return 0;
+	}
+	for (i = 0; i < num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (end - len < rg->rg_base + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_base < end) {
+			/* In the way; try just below it */
+			end = rg->rg_base;
+			goto again;
+		}
+	}
+	return end - len;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t *addr, size_t len, int perms,
+	int flags, bool fixed, struct vnode *v, off_t offset, off_t filesize)
+{
+	struct region *rg;
+	vaddr_t vaddr;
+	size_t npages;
+	int result;
+
+	KASSERT(len > 0);
+	KASSERT((*addr & PAGE_FRAME) == *addr);
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	len = npages * PAGE_SIZE;
+
+	lock_acquire(as->as_lock);
+
+	vaddr = *addr;
+	if (!as_range_free(as, vaddr, len)) {
+		if (fixed) {
+			/* We don't replace existing mappings */
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+		vaddr = as_find_space(as, len);
+		if (vaddr == 0) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+	}
+
+	result = as_add_region(as, vaddr, npages, perms);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	rg = regionarray_get(&as->as_regions,
+			     regionarray_num(&as->as_regions) - 1);
+	rg->rg_flags = RGF_MMAP | flags;
+
+	if (v != NULL) {
+		VOP_INCREF(v);
+		rg->rg_vnode = v;
+		rg->rg_offset = offset;
+		if (flags & RGF_SHARED) {
+			/* Past the end of the file we still share the zeroes */
+			rg->rg_filesize = len;
+		}
+		else if (filesize > offset) {
+			rg->rg_filesize = (filesize - offset < (off_t)len) ?
+			    filesize - offset : len;
+		}
+	}
+
+	lock_release(as->as_lock);
+
+	*addr = vaddr;
+	return 0;
+}
+
+/*
+ * Take away the pages in [START, END): first make them invalid so
+ * nothing can load them into a TLB any more, then shoot down any TLB
+ * entries, and only then free the frames. The caller must hold
+ * as_lock.
+ */
+static
+int
+as_invalidate_page(vaddr_t vaddr, pte_t *pte, void *data)
+{
+	(void)vaddr;
+	(void)data;
+
+	if (*pte & PTE_VALID) {
+		*pte &= ~(pte_t)(PTE_VALID | PTE_WRITE);
+	}
+	return 0;
+}
+
+static
+void
+as_unmap_pages(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+	vaddr_t vaddrs[TLBSHOOTDOWN_MAX];
+	unsigned i, npages;
+
+	pt_walk(as->as_pt, start, end, as_invalidate_page, NULL);
+
+	/* More than TLBSHOOTDOWN_MAX pages drops the whole address space */
+	npages = (end - start) / PAGE_SIZE;
+	for (i = 0; i < npages && i < TLBSHOOTDOWN_MAX; i++) {
+		vaddrs[i] = start + i * PAGE_SIZE;
+	}
+	vm_shootdown(as, vaddrs, npages);
+
+	pt_walk(as->as_pt, start, end, as_free_page, NULL);
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg, *tail;
+	vaddr_t end, rgend, s, e;
+	unsigned i;
+	int result;
+
+	if ((vaddr & PAGE_FRAME) != vaddr || len == 0 ||
+	    len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	end = (vaddr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	lock_acquire(as->as_lock);
+
+	/*
+	 * Only mmap's own regions can go. Check them all before changing
+	 * anything; a range in the middle of a single region splits it,
+	 * so make the second half now, while we can still back out.
+	 */
+	tail = NULL;
+	for (i = 0; i < regionarray_num(&as->as_regions); i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		rgend = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		if (vaddr >= rgend || rg->rg_base >= end) {
+			continue;
+		}
+		if (!(rg->rg_flags & RGF_MMAP)) {
+			lock_release(as->as_lock);
+			return EINVAL;
+		}
+		if (vaddr > rg->rg_base && end < rgend) {
+			result = as_add_region(as, end, (rgend - end) / PAGE_SIZE,
+					       rg->rg_perms);
+			if (result) {
+				lock_release(as->as_lock);
+				return result;
+			}
+			tail = regionarray_get(&as->as_regions,
+					       regionarray_num(&as->as_regions) - 1);
+			tail->rg_flags = rg->rg_flags;
+			if (rg->rg_vnode != NULL) {
+				VOP_INCREF(rg->rg_vnode);
+				tail->rg_vnode = rg->rg_vnode;
+				tail->rg_filebase = rg->rg_filebase;
+				tail->rg_filesize = rg->rg_filesize;
+				tail->rg_offset = rg->rg_offset;
+			}
+			break;
+		}
+	}
+
+	as_unmap_pages(as, vaddr, end);
+
+	for (i = regionarray_num(&as->as_regions); i > 0; i--) {
+		rg = regionarray_get(&as->as_regions, i - 1);
+		if (rg == tail) {
+			continue;
+		}
+		rgend = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		if (vaddr >= rgend || rg->rg_base >= end) {
+			continue;
+		}
+		s = (vaddr > rg->rg_base) ? vaddr : rg->rg_base;
+		e = (end < rgend) ? end : rgend;
+
+		/* Our references are gone; this makes the pages clean */
+		as_writeback(rg, s, e);
+
+		if (s == rg->rg_base && e == rgend) {
+			if (rg->rg_vnode != NULL) {
+				VOP_DECREF(rg->rg_vnode);
+			}
+			kfree(rg);
+			regionarray_remove(&as->as_regions, i - 1);
+		}
+		else if (s == rg->rg_base) {
+			rg->rg_npages -= (e - s) / PAGE_SIZE;
+			rg->rg_base = e;
+		}
+		else {
+			/* The tail end, or the middle with the rest in TAIL */
+			rg->rg_npages = (s - rg->rg_base) / PAGE_SIZE;
+		}
+	}
+
+	lock_release(as->as_lock);
+
+	return 0;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t end, s, e;
+	int result;
+
+	if ((vaddr & PAGE_FRAME) != vaddr || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	end = (vaddr + len + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	lock_acquire(as->as_lock);
+
+	for (s = vaddr; s < end; s = e) {
+		rg = as_find_region(as, s);
+		if (rg == NULL) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+		e = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+		if (e > end) {
+			e = end;
+		}
+		result = as_writeback(rg, s, e);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+
+	lock_release(as->as_lock);
+
+	return 0;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+	struct region *heap;
+	vaddr_t brk, oldend, newend;
+
+	lock_acquire(as->as_lock);
+
+	heap = as->as_heap;
+	if (heap == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	brk = as->as_brk + amount;
+	if (amount < 0 ? brk > as->as_brk || brk < heap->rg_base :
+			 brk < as->as_brk || brk > VM_MMAPTOP) {
+		lock_release(as->as_lock);
+		return amount < 0 ? EINVAL : ENOMEM;
+	}
+
+	oldend = heap->rg_base + heap->rg_npages * PAGE_SIZE;
+	newend = (brk + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	if (newend > oldend) {
+		/* Only reserve the space; vm_fault fills it in */
+		if (!as_range_free(as, oldend, newend - oldend)) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+	}
+	else if (newend < oldend) {
+		/* Give back the frames now, not when the process exits */
+		as_unmap_pages(as, newend, oldend);
+	}
+	heap->rg_npages = (newend - heap->rg_base) / PAGE_SIZE;
+
+	*oldbrk = as->as_brk;
+	as->as_brk = brk;
+
+	lock_release(as->as_lock);
+
+	return 0;
+}
+
+struct region *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack;
+	vaddr_t base;
+
+	stack = as->as_stack;
+	if (stack == NULL || vaddr >= stack->rg_base ||
+	    vaddr < USERSTACK - as_stacklimit * PAGE_SIZE) {
+		return NULL;
+	}
+
+	/* Keep a guard page between the stack and whatever is below it */
+	base = vaddr & PAGE_FRAME;
+	if (!as_range_free(as, base - PAGE_SIZE,
+			   stack->rg_base - base + PAGE_SIZE)) {
+		return NULL;
+	}
+
+	stack->rg_npages += (stack->rg_base - base) / PAGE_SIZE;
+	stack->rg_base = base;
+	stack->rg_filebase = base;
+
+	return stack;
+}
+
+int
+as_setstacklimit(unsigned npages)
+{
+	if (npages < VM_STACKMIN || npages > VM_STACKMAX) {
+		return EINVAL;
+	}
+	as_stacklimit = npages;
+	return 0;
+}
+
+unsigned
+as_getstacklimit(void)
+{
+	return as_stacklimit;
+}
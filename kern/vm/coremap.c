@@ -0,0 +1,1295 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+
+/*
+ * Coremap: one entry per physical frame.
+ *
+ * Frames below the first free address at bootstrap time hold the
+ * kernel image, the coremap itself and whatever was stolen during
+ * early boot; they are marked CME_FIXED and never reused.
+ *
+ * Free frames are managed by a binary buddy allocator. Free memory
+ * is split into blocks of 2^order frames, each aligned to its size,
+ * and each order has a doubly linked list of free blocks threaded
+ * through the coremap entries of their first frames (ce_order says
+ * which list a block is on). An allocation of N contiguous frames
+ * takes the smallest block big enough, splitting larger ones in half
+ * as needed, and gives back what it doesn't use. A freed block is
+ * merged with its buddy (the other half of the block they were split
+ * from) for as long as the buddy is free too, so large runs form
+ * again as memory is released instead of staying fragmented.
+ *
+ * To keep single-page traffic off the global lock, each CPU has a
+ * small cache of free frames (struct coremap_pcpu, in struct cpu).
+ * Frames in a CPU's cache are CME_CACHED and belong to that CPU; it
+ * only has to disable interrupts to use them. The cache is refilled
+ * from the free list when empty and drained back into it when full,
+ * a batch at a time.
+ *
+ * When no frame is free, a user page is paged out to make room. The
+ * victim is chosen by the clock (second chance) algorithm: a hand
+ * sweeps the coremap, skipping frames used since it last went by
+ * (ce_referenced, set by vm_fault) and clearing their bit. Only
+ * unshared user pages with a known owner can be evicted. While a
+ * frame is being paged out or cleaned it is CMF_BUSY, and anyone
+ * freeing it has to wait; this keeps its owner address space alive
+ * until the evictor is done with it.
+ *
+ * A user page that isn't CMF_DIRTY is identical to its copy in swap
+ * (ce_slot), or if it has none, to what vm_fault would fill it with
+ * again (zeroes or file contents), so evicting it costs no I/O. The pageout thread keeps free memory between its
+ * watermarks and writes dirty pages ahead of the clock hand out in
+ * batches (coremap_clean), so that most victims are clean.
+ *
+ * Frames held by the page cache have no owner, so the clock never
+ * picks them. When memory is short, cached pages that nobody maps
+ * any more are given back first (pagecache_reclaim), since that
+ * costs nothing at all.
+ *
+ * Idle CPUs zero free frames and move them to a second list, the
+ * zero pool (CME_ZERO), so that a fault on a fresh anonymous page
+ * can usually take a page that is already zero-filled instead of
+ * clearing one itself. The pool is kept small; its frames still
+ * count as free, and are handed out like any other free frame once
+ * the free list runs dry.
+ */
+
+#define CM_NOFRAME	0xffffffff		/* End of free list */
+#define CM_NOORDER	0xff		/* ce_order of frames that aren't a block */
+
+/* Frame flags; only changed with coremap_lock held */
+#define CMF_BUSY	0x01	/* Being paged out or cleaned */
+#define CMF_DIRTY	0x02	/* Changed since last written to swap */
+
+/* Victims to try before giving up on finding one whose owner is free */
+#define CM_EVICT_TRIES	8
+
+/* Most frames to keep pre-zeroed, at most 1/16 of memory */
+#define CM_ZERO_POOL	64
+
+struct coremap_entry {
+	struct addrspace *ce_as;	/* Owner of a user page; NULL if shared */
+	vaddr_t ce_vaddr;		/* Where the owner maps it */
+	uint32_t ce_next;		/* List links, if CME_FREE or CME_ZERO */
+	uint32_t ce_prev;
+	uint32_t ce_npages;		/* Size of the block, on its first frame */
+	uint32_t ce_slot;		/* Swap copy of a user page, or SWAP_NOSLOT */
+	uint16_t ce_refcount;		/* Address spaces mapping a user page */
+	uint8_t ce_state;		/* CME_* */
+	uint8_t ce_flags;		/* CMF_* */
+	uint8_t ce_referenced;		/* Used since the clock hand passed (hint) */
+	uint8_t ce_order;		/* Free block size, on its first frame */
+};
+
+/*
+ * Wrap ram_stealmem in a spinlock.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Protects the coremap once it exists.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct coremap_entry *coremap = NULL;
+static unsigned long coremap_nframes;
+static unsigned long coremap_firstframe;	/* First frame we manage */
+static uint32_t coremap_freeheads[CM_NORDERS];	/* Buddy lists by order */
+static unsigned long coremap_freeblocks[CM_NORDERS];
+static uint32_t coremap_zerohead = CM_NOFRAME;		/* The zero pool */
+static unsigned long coremap_zeromax;
+
+/*
+ * Number of frames in each CME_* state. These can go transiently
+ * negative, because changes made through per-CPU caches are folded
+ * in at different times on different CPUs.
+ */
+static long coremap_counts[CME_NSTATES];
+static unsigned long coremap_refills, coremap_drains;
+static unsigned long coremap_zerohits, coremap_zeromisses;
+static unsigned long coremap_zerofilled;	/* Frames zeroed while idle */
+
+/* Page replacement */
+static unsigned long coremap_clockhand;
+static struct wchan *coremap_wchan;	/* Waiting for CMF_BUSY to clear */
+static unsigned long coremap_scans;	/* Frames looked at by the clock */
+static unsigned long coremap_evictions;
+static unsigned long coremap_cleaned;	/* Dirty pages written ahead */
+
+/* Pageout thread waits here until free frames drop below the watermark */
+static struct wchan *coremap_pageout_wchan;
+static unsigned long coremap_lowater;
+
+static bool coremap_ready = false;
+
+/*
+ * Free block list and zero pool manipulation. Called with
+ * coremap_lock held.
+ */
+static
+void
+coremap_list_push(uint32_t *head, uint32_t frame)
+{
+	coremap[frame].ce_prev = CM_NOFRAME;
+	coremap[frame].ce_next = *head;
+	if (*head != CM_NOFRAME) {
+		coremap[*head].ce_prev = frame;
+	}
+	*head = frame;
+}
+
+static
+void
+coremap_list_remove(uint32_t *head, uint32_t frame)
+{
+	struct coremap_entry *ce = &coremap[frame];
+
+	if (ce->ce_prev != CM_NOFRAME) {
+		coremap[ce->ce_prev].ce_next = ce->ce_next;
+	}
+	else {
+		KASSERT(*head == frame);
+		*head = ce->ce_next;
+	}
+	if (ce->ce_next != CM_NOFRAME) {
+		coremap[ce->ce_next].ce_prev = ce->ce_prev;
+	}
+	ce->ce_next = ce->ce_prev = CM_NOFRAME;
+}
+
+/*
+ * Move a frame to a new state, keeping the per-state counts in step.
+ * Called with coremap_lock held.
+ */
+static
+void
+coremap_setstate(uint32_t frame, uint8_t state)
+{
+	coremap_counts[coremap[frame].ce_state]--;
+	coremap_counts[state]++;
+	coremap[frame].ce_state = state;
+}
+
+/*
+ * Put the free block of 2^ORDER frames at FRAME on its list. Its
+ * frames must already be CME_FREE. Called with coremap_lock held.
+ */
+static
+void
+coremap_buddy_insert(uint32_t frame, unsigned order)
+{
+	coremap_list_push(&coremap_freeheads[order], frame);
+	coremap[frame].ce_order = order;
+	coremap_freeblocks[order]++;
+}
+
+static
+void
+coremap_buddy_unlink(uint32_t frame)
+{
+	unsigned order = coremap[frame].ce_order;
+
+	KASSERT(order < CM_NORDERS);
+	coremap_list_remove(&coremap_freeheads[order], frame);
+	coremap[frame].ce_order = CM_NOORDER;
+	coremap_freeblocks[order]--;
+}
+
+/*
+ * Take a free block of 2^ORDER frames, splitting a larger one if
+ * need be. Its frames stay CME_FREE for the caller to change. Returns
+ * CM_NOFRAME if there is no block that big. Called with coremap_lock
+ * held.
+ */
+static
+uint32_t
+coremap_buddy_alloc(unsigned order)
+{
+	uint32_t frame;
+	unsigned k;
+
+	for (k = order; k < CM_NORDERS; k++) {
+		if (coremap_freeheads[k] != CM_NOFRAME) {
+			break;
+		}
+	}
+	if (k == CM_NORDERS) {
+		return CM_NOFRAME;
+	}
+
+	frame = coremap_freeheads[k];
+	coremap_buddy_unlink(frame);
+	while (k > order) {
+		/* Keep the low half, free the high half */
+		k--;
+		coremap_buddy_insert(frame + (1U << k), k);
+	}
+	return frame;
+}
+
+/*
+ * Free the block of 2^ORDER CME_FREE frames at FRAME, merging it
+ * with its buddy as long as that is free too. Called with
+ * coremap_lock held.
+ */
+static
+void
+coremap_buddy_free(uint32_t frame, unsigned order)
+{
+	uint32_t buddy;
+
+	while (order + 1 < CM_NORDERS) {
+		buddy = frame ^ (1U << order);
+		if (buddy < coremap_firstframe ||
+		    buddy + (1U << order) > coremap_nframes ||
+		    coremap[buddy].ce_state != CME_FREE ||
+		    coremap[buddy].ce_order != order) {
+			break;
+		}
+		coremap_buddy_unlink(buddy);
+		if (buddy < frame) {
+			frame = buddy;
+		}
+		order++;
+	}
+	coremap_buddy_insert(frame, order);
+}
+
+/*
+ * Free NPAGES CME_FREE frames starting at FRAME, as the largest
+ * aligned blocks that fit. Called with coremap_lock held.
+ */
+static
+void
+coremap_buddy_freerange(uint32_t frame, unsigned long npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order + 1 < CM_NORDERS &&
+		       frame % (1U << (order + 1)) == 0 &&
+		       (1UL << (order + 1)) <= npages) {
+			order++;
+		}
+		coremap_buddy_free(frame, order);
+		frame += 1U << order;
+		npages -= 1UL << order;
+	}
+}
+
+/*
+ * Give every frame in the zero pool back to the buddy lists, so they
+ * can merge into larger blocks again. Called with coremap_lock held.
+ */
+static
+void
+coremap_zero_flush(void)
+{
+	uint32_t frame;
+
+	while ((frame = coremap_zerohead) != CM_NOFRAME) {
+		coremap_list_remove(&coremap_zerohead, frame);
+		coremap_setstate(frame, CME_FREE);
+		coremap_buddy_free(frame, 0);
+	}
+}
+
+/*
+ * Frames free on both lists, for the watermarks. Called with
+ * coremap_lock held.
+ */
+static
+long
+coremap_nfree(void)
+{
+	return coremap_counts[CME_FREE] + coremap_counts[CME_ZERO];
+}
+
+/*
+ * Set up a frame just taken for some state other than free, owned by
+ * AS at VADDR. The caller has already changed ce_state.
+ */
+static
+void
+coremap_claim(uint32_t frame, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *ce = &coremap[frame];
+
+	ce->ce_as = as;
+	ce->ce_vaddr = vaddr;
+	ce->ce_refcount = 1;
+	ce->ce_npages = 1;
+	ce->ce_flags = 0;
+	ce->ce_referenced = 0;
+}
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t cmpaddr, firstfree;
+	unsigned long i, cmpages;
+
+	KASSERT(coremap == NULL);
+
+	coremap_nframes = ram_getsize() / PAGE_SIZE;
+	cmpages = DIVROUNDUP(coremap_nframes * sizeof(struct coremap_entry),
+			     PAGE_SIZE);
+
+	spinlock_acquire(&stealmem_lock);
+	cmpaddr = ram_stealmem(cmpages);
+	firstfree = ram_getfirstfree();
+	spinlock_release(&stealmem_lock);
+
+	if (cmpaddr == 0) {
+		panic("coremap: cannot allocate %lu pages for the coremap\n",
+		      cmpages);
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	coremap_firstframe = firstfree / PAGE_SIZE;
+	for (i = 0; i < coremap_nframes; i++) {
+		coremap[i].ce_as = NULL;
+		coremap[i].ce_vaddr = 0;
+		coremap[i].ce_next = coremap[i].ce_prev = CM_NOFRAME;
+		coremap[i].ce_npages = 0;
+		coremap[i].ce_refcount = 0;
+		coremap[i].ce_state = (i < coremap_firstframe) ? CME_FIXED : CME_FREE;
+		coremap[i].ce_flags = 0;
+		coremap[i].ce_slot = SWAP_NOSLOT;
+		coremap[i].ce_referenced = 0;
+		coremap[i].ce_order = CM_NOORDER;
+	}
+	for (i = 0; i < CM_NORDERS; i++) {
+		coremap_freeheads[i] = CM_NOFRAME;
+	}
+	coremap_buddy_freerange(coremap_firstframe,
+				coremap_nframes - coremap_firstframe);
+	coremap_counts[CME_FIXED] = coremap_firstframe;
+	coremap_counts[CME_FREE] = coremap_nframes - coremap_firstframe;
+	coremap_clockhand = coremap_firstframe;
+	coremap_zeromax = (coremap_nframes - coremap_firstframe) / 16;
+	if (coremap_zeromax > CM_ZERO_POOL) {
+		coremap_zeromax = CM_ZERO_POOL;
+	}
+
+	coremap_wchan = wchan_create("coremap");
+	coremap_pageout_wchan = wchan_create("pageout");
+	if (coremap_wchan == NULL || coremap_pageout_wchan == NULL) {
+		panic("coremap: cannot create wchan\n");
+	}
+
+	spinlock_acquire(&coremap_lock);
+	coremap_ready = true;
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %lu frames, %lu free\n", coremap_nframes,
+		coremap_nframes - coremap_firstframe);
+}
+
+void
+coremap_pcpu_init(struct coremap_pcpu *cp)
+{
+	unsigned i;
+
+	cp->cp_nframes = 0;
+	for (i = 0; i < CME_NSTATES; i++) {
+		cp->cp_counts[i] = 0;
+	}
+}
+
+/*
+ * Fold a CPU's pending count changes into the global counts. Called
+ * with coremap_lock held and interrupts off.
+ */
+static
+void
+coremap_pcpu_sync(struct coremap_pcpu *cp)
+{
+	unsigned i;
+
+	for (i = 0; i < CME_NSTATES; i++) {
+		coremap_counts[i] += cp->cp_counts[i];
+		cp->cp_counts[i] = 0;
+	}
+}
+
+/*
+ * Move up to a batch of frames from the free list into an empty
+ * per-CPU cache. Called with interrupts off.
+ */
+static
+void
+coremap_pcpu_refill(struct coremap_pcpu *cp)
+{
+	uint32_t frame;
+
+	KASSERT(cp->cp_nframes == 0);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_pcpu_sync(cp);
+	while (cp->cp_nframes < CM_PCPU_BATCH) {
+		/* Save the zeroed frames for zero-fill faults if we can */
+		frame = coremap_buddy_alloc(0);
+		if (frame == CM_NOFRAME) {
+			frame = coremap_zerohead;
+			if (frame == CM_NOFRAME) {
+				break;
+			}
+			coremap_list_remove(&coremap_zerohead, frame);
+		}
+		coremap_setstate(frame, CME_CACHED);
+		cp->cp_frames[cp->cp_nframes++] = frame;
+	}
+	coremap_refills++;
+	if (coremap_nfree() < (long)coremap_lowater) {
+		wchan_wakeone(coremap_pageout_wchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return a batch of frames from a full per-CPU cache to the free
+ * list. The oldest frames go; the most recently freed ones, which
+ * are the likeliest to still be in the processor cache, stay. Called
+ * with interrupts off.
+ */
+static
+void
+coremap_pcpu_drain(struct coremap_pcpu *cp)
+{
+	unsigned i;
+
+	KASSERT(cp->cp_nframes == CM_PCPU_FRAMES);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_pcpu_sync(cp);
+	for (i = 0; i < CM_PCPU_BATCH; i++) {
+		KASSERT(coremap[cp->cp_frames[i]].ce_state == CME_CACHED);
+		coremap_setstate(cp->cp_frames[i], CME_FREE);
+		coremap_buddy_free(cp->cp_frames[i], 0);
+	}
+	coremap_drains++;
+	spinlock_release(&coremap_lock);
+
+	for (i = CM_PCPU_BATCH; i < CM_PCPU_FRAMES; i++) {
+		cp->cp_frames[i - CM_PCPU_BATCH] = cp->cp_frames[i];
+	}
+	cp->cp_nframes -= CM_PCPU_BATCH;
+}
+
+/*
+ * Take a single frame for STATE from this CPU's cache, refilling it
+ * if necessary. Returns CM_NOFRAME if memory is exhausted.
+ */
+static
+uint32_t
+coremap_getframe(uint8_t state, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_pcpu *cp;
+	struct coremap_entry *ce;
+	uint32_t frame;
+	int spl;
+
+	spl = splhigh();
+	cp = &curcpu->c_coremap;
+
+	if (cp->cp_nframes == 0) {
+		coremap_pcpu_refill(cp);
+		if (cp->cp_nframes == 0) {
+			splx(spl);
+			return CM_NOFRAME;
+		}
+	}
+
+	frame = cp->cp_frames[--cp->cp_nframes];
+	ce = &coremap[frame];
+	KASSERT(ce->ce_state == CME_CACHED);
+	ce->ce_state = state;
+	coremap_claim(frame, as, vaddr);
+	cp->cp_counts[CME_CACHED]--;
+	cp->cp_counts[state]++;
+
+	splx(spl);
+
+	return frame;
+}
+
+/*
+ * Give a single unshared frame back to this CPU's cache, draining it
+ * first if it is full.
+ */
+static
+void
+coremap_putframe(uint32_t frame)
+{
+	struct coremap_pcpu *cp;
+	struct coremap_entry *ce;
+	int spl;
+
+	spl = splhigh();
+	cp = &curcpu->c_coremap;
+
+	if (cp->cp_nframes == CM_PCPU_FRAMES) {
+		coremap_pcpu_drain(cp);
+	}
+
+	ce = &coremap[frame];
+	cp->cp_counts[ce->ce_state]--;
+	cp->cp_counts[CME_CACHED]++;
+	ce->ce_state = CME_CACHED;
+	ce->ce_as = NULL;
+	ce->ce_vaddr = 0;
+	ce->ce_refcount = 0;
+	ce->ce_npages = 0;
+	ce->ce_flags = 0;
+	cp->cp_frames[cp->cp_nframes++] = frame;
+
+	splx(spl);
+}
+
+/*
+ * Multi-page kernel allocations: take the smallest buddy block that
+ * holds NPAGES contiguous frames and give back the rest of it. If
+ * there is none, the frames sitting in the zero pool may be what
+ * keeps smaller blocks from merging, so return those and try again.
+ * Called with coremap_lock held.
+ */
+static
+uint32_t
+coremap_getframes(unsigned long npages)
+{
+	unsigned long i;
+	uint32_t first;
+	unsigned order;
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (order >= CM_NORDERS) {
+		return CM_NOFRAME;
+	}
+
+	first = coremap_buddy_alloc(order);
+	if (first == CM_NOFRAME && coremap_zerohead != CM_NOFRAME) {
+		coremap_zero_flush();
+		first = coremap_buddy_alloc(order);
+	}
+	if (first == CM_NOFRAME) {
+		return CM_NOFRAME;
+	}
+	coremap_buddy_freerange(first + npages, (1UL << order) - npages);
+
+	for (i = first; i < first + npages; i++) {
+		coremap_setstate(i, CME_KERNEL);
+		coremap[i].ce_refcount = 1;
+		coremap[i].ce_npages = 0;
+	}
+	coremap[first].ce_npages = npages;
+
+	return first;
+}
+
+/*
+ * Advance the clock hand to the next page that can be evicted.
+ * Called with coremap_lock held; returns CM_NOFRAME if two sweeps
+ * find nothing.
+ */
+static
+uint32_t
+coremap_clock(void)
+{
+	struct coremap_entry *ce;
+	unsigned long i, frame;
+
+	for (i = 0; i < 2 * (coremap_nframes - coremap_firstframe); i++) {
+		frame = coremap_clockhand++;
+		if (coremap_clockhand == coremap_nframes) {
+			coremap_clockhand = coremap_firstframe;
+		}
+		coremap_scans++;
+
+		ce = &coremap[frame];
+		if (ce->ce_state != CME_USER || ce->ce_as == NULL ||
+		    ce->ce_refcount != 1 || (ce->ce_flags & CMF_BUSY)) {
+			continue;
+		}
+		if (ce->ce_referenced) {
+			/* Second chance */
+			ce->ce_referenced = 0;
+			continue;
+		}
+		return frame;
+	}
+
+	return CM_NOFRAME;
+}
+
+/*
+ * Page out a user page to free up a frame, and hand the frame
+ * straight to the caller as STATE, owned by AS at VADDR. If STATE is
+ * CME_FREE the frame goes back on the free list instead. Returns
+ * CM_NOFRAME if nothing could be evicted.
+ */
+static
+uint32_t
+coremap_evict(uint8_t state, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *ce;
+	struct addrspace *victim_as;
+	vaddr_t victim_vaddr;
+	uint32_t frame;
+	unsigned tries;
+	int result;
+
+	for (tries = 0; tries < CM_EVICT_TRIES; tries++) {
+		spinlock_acquire(&coremap_lock);
+		frame = coremap_clock();
+		if (frame == CM_NOFRAME) {
+			spinlock_release(&coremap_lock);
+			return CM_NOFRAME;
+		}
+		ce = &coremap[frame];
+		ce->ce_flags |= CMF_BUSY;
+		victim_as = ce->ce_as;
+		victim_vaddr = ce->ce_vaddr;
+		spinlock_release(&coremap_lock);
+
+		result = vm_evict(victim_as, victim_vaddr, (paddr_t)frame * PAGE_SIZE);
+
+		spinlock_acquire(&coremap_lock);
+		ce->ce_flags &= ~CMF_BUSY;
+		wchan_wakeall(coremap_wchan, &coremap_lock);
+		if (result == 0) {
+			/* Nothing maps the frame any more; it's ours */
+			KASSERT(ce->ce_state == CME_USER && ce->ce_refcount == 1);
+			KASSERT(ce->ce_slot == SWAP_NOSLOT);
+			coremap_setstate(frame, state);
+			ce->ce_as = as;
+			ce->ce_vaddr = vaddr;
+			ce->ce_flags = 0;
+			ce->ce_referenced = 0;
+			coremap_evictions++;
+			if (state == CME_FREE) {
+				ce->ce_refcount = 0;
+				ce->ce_npages = 0;
+				coremap_buddy_free(frame, 0);
+			}
+			spinlock_release(&coremap_lock);
+			return frame;
+		}
+		spinlock_release(&coremap_lock);
+
+		if (result != EBUSY) {
+			/* Out of swap, or an I/O error */
+			return CM_NOFRAME;
+		}
+	}
+
+	return CM_NOFRAME;
+}
+
+/*
+ * Memory ran out before the pageout thread could keep up; make sure
+ * it is running.
+ */
+static
+void
+coremap_wakepageout(void)
+{
+	spinlock_acquire(&coremap_lock);
+	wchan_wakeone(coremap_pageout_wchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * No frame is free: get one for STATE, owned by AS at VADDR, by
+ * dropping an unused page cache page or else paging something out.
+ */
+static
+uint32_t
+coremap_steal(uint8_t state, struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t frame;
+
+	coremap_wakepageout();
+
+	if (pagecache_reclaim(1) > 0) {
+		frame = coremap_getframe(state, as, vaddr);
+		if (frame != CM_NOFRAME) {
+			return frame;
+		}
+	}
+	return coremap_evict(state, as, vaddr);
+}
+
+paddr_t
+coremap_alloc_kpages(unsigned long npages)
+{
+	uint32_t frame;
+	paddr_t paddr;
+
+	KASSERT(npages > 0);
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_ready) {
+		spinlock_release(&coremap_lock);
+
+		spinlock_acquire(&stealmem_lock);
+		paddr = ram_stealmem(npages);
+		spinlock_release(&stealmem_lock);
+
+		return paddr;
+	}
+
+	if (npages == 1) {
+		spinlock_release(&coremap_lock);
+		frame = coremap_getframe(CME_KERNEL, NULL, 0);
+		if (frame == CM_NOFRAME) {
+			frame = coremap_steal(CME_KERNEL, NULL, 0);
+		}
+	}
+	else {
+		frame = coremap_getframes(npages);
+		spinlock_release(&coremap_lock);
+	}
+
+	if (frame == CM_NOFRAME) {
+		return 0;
+	}
+	return (paddr_t)frame * PAGE_SIZE;
+}
+
+paddr_t
+coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t frame;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT(coremap_ready);
+
+	frame = coremap_getframe(CME_USER, as, vaddr);
+	if (frame == CM_NOFRAME) {
+		frame = coremap_steal(CME_USER, as, vaddr);
+	}
+
+	if (frame == CM_NOFRAME) {
+		return 0;
+	}
+	return (paddr_t)frame * PAGE_SIZE;
+}
+
+paddr_t
+coremap_alloc_zpage(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t frame;
+	paddr_t paddr;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT(coremap_ready);
+
+	spinlock_acquire(&coremap_lock);
+	frame = coremap_zerohead;
+	if (frame != CM_NOFRAME) {
+		coremap_list_remove(&coremap_zerohead, frame);
+		coremap_setstate(frame, CME_USER);
+		coremap_claim(frame, as, vaddr);
+		coremap_zerohits++;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)frame * PAGE_SIZE;
+	}
+	coremap_zeromisses++;
+	spinlock_release(&coremap_lock);
+
+	paddr = coremap_alloc_upage(as, vaddr);
+	if (paddr != 0) {
+		bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+	}
+	return paddr;
+}
+
+bool
+coremap_zero_idle(void)
+{
+	uint32_t frame;
+	int spl;
+
+	if (!coremap_ready) {
+		return false;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_counts[CME_ZERO] >= (long)coremap_zeromax) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	frame = coremap_buddy_alloc(0);
+	if (frame == CM_NOFRAME) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	/* On neither list while we work on it, so nobody takes it */
+	coremap_setstate(frame, CME_ZERO);
+	coremap[frame].ce_flags = CMF_BUSY;
+	spinlock_release(&coremap_lock);
+
+	/*
+	 * The idle loop calls this with interrupts off; don't hold them
+	 * off for a whole page. Anything they make runnable is seen when
+	 * it looks again, since we return true.
+	 */
+	spl = spl0();
+	bzero((void *)PADDR_TO_KVADDR((paddr_t)frame * PAGE_SIZE), PAGE_SIZE);
+	splx(spl);
+
+	spinlock_acquire(&coremap_lock);
+	coremap[frame].ce_flags = 0;
+	coremap_list_push(&coremap_zerohead, frame);
+	coremap_zerofilled++;
+	spinlock_release(&coremap_lock);
+
+	return true;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned long i, frame, npages;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	frame = paddr / PAGE_SIZE;
+
+	if (!coremap_ready || frame < coremap_firstframe) {
+		/* Stolen before bootstrap; we can't get it back */
+		return;
+	}
+
+	KASSERT(frame < coremap_nframes);
+	KASSERT(coremap[frame].ce_state == CME_KERNEL ||
+		coremap[frame].ce_state == CME_USER);
+	KASSERT(coremap[frame].ce_refcount > 0);
+
+	/*
+	 * A single kernel page is never shared or paged out, so it can go
+	 * to the per-CPU cache without locking.
+	 */
+	if (coremap[frame].ce_state == CME_KERNEL &&
+	    coremap[frame].ce_npages == 1) {
+		coremap_putframe(frame);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	while (coremap[frame].ce_flags & CMF_BUSY) {
+		wchan_sleep(coremap_wchan, &coremap_lock);
+	}
+
+	coremap[frame].ce_refcount--;
+	if (coremap[frame].ce_refcount > 0) {
+		/* Still shared with another address space */
+		KASSERT(coremap[frame].ce_state == CME_USER);
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	npages = coremap[frame].ce_npages;
+	KASSERT(npages > 0 && frame + npages <= coremap_nframes);
+
+	for (i = frame; i < frame + npages; i++) {
+		if (coremap[i].ce_slot != SWAP_NOSLOT) {
+			swap_free(coremap[i].ce_slot);
+			coremap[i].ce_slot = SWAP_NOSLOT;
+		}
+		coremap[i].ce_as = NULL;
+		coremap[i].ce_vaddr = 0;
+		coremap[i].ce_refcount = 0;
+		coremap[i].ce_npages = 0;
+		coremap[i].ce_flags = 0;
+		coremap[i].ce_referenced = 0;
+	}
+
+	if (npages == 1 && curcpu->c_coremap.cp_nframes < CM_PCPU_FRAMES) {
+		/* Holding the spinlock keeps interrupts off for us */
+		coremap_setstate(frame, CME_CACHED);
+		curcpu->c_coremap.cp_frames[curcpu->c_coremap.cp_nframes++] = frame;
+	}
+	else {
+		for (i = frame; i < frame + npages; i++) {
+			coremap_setstate(i, CME_FREE);
+		}
+		coremap_buddy_freerange(frame, npages);
+	}
+
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Add a reference to a user page, so that it can be mapped by one
+ * more address space. Each reference is dropped with coremap_free.
+ * A shared page has no single owner any more.
+ */
+void
+coremap_incref(paddr_t paddr)
+{
+	unsigned long frame;
+
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_ready);
+	KASSERT(frame >= coremap_firstframe && frame < coremap_nframes);
+	KASSERT(coremap[frame].ce_state == CME_USER);
+	KASSERT(coremap[frame].ce_refcount > 0);
+	coremap[frame].ce_refcount++;
+	coremap[frame].ce_as = NULL;
+	coremap[frame].ce_vaddr = 0;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Return the number of references to a user page.
+ */
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned long frame;
+	unsigned refcount;
+
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(frame >= coremap_firstframe && frame < coremap_nframes);
+	KASSERT(coremap[frame].ce_state == CME_USER);
+	refcount = coremap[frame].ce_refcount;
+	spinlock_release(&coremap_lock);
+
+	return refcount;
+}
+
+/*
+ * Record that a user page that used to be shared now belongs to AS
+ * alone, mapped at VADDR.
+ */
+void
+coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned long frame;
+
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(frame >= coremap_firstframe && frame < coremap_nframes);
+	KASSERT(coremap[frame].ce_state == CME_USER);
+	KASSERT(coremap[frame].ce_refcount == 1);
+	coremap[frame].ce_as = as;
+	coremap[frame].ce_vaddr = vaddr;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Note that a user page has just been used, so the clock passes it
+ * over next time. This is only a hint, so it's not worth locking.
+ */
+void
+coremap_touch(paddr_t paddr)
+{
+	unsigned long frame;
+
+	frame = paddr / PAGE_SIZE;
+	KASSERT(frame >= coremap_firstframe && frame < coremap_nframes);
+
+	coremap[frame].ce_referenced = 1;
+}
+
+/*
+ * Dirty tracking for unshared user pages. The dirty bit of a page
+ * only changes while its owner's address space is locked, so the
+ * owner can check it without taking coremap_lock.
+ */
+bool
+coremap_isdirty(paddr_t paddr)
+{
+	unsigned long frame;
+
+	frame = paddr / PAGE_SIZE;
+	KASSERT(frame >= coremap_firstframe && frame < coremap_nframes);
+	KASSERT(coremap[frame].ce_state == CME_USER);
+
+	return (coremap[frame].ce_flags & CMF_DIRTY) != 0;
+}
+
+/*
+ * The page is about to be written, so any copy in swap is stale.
+ */
+void
+coremap_setdirty(paddr_t paddr)
+{
+	unsigned long frame;
+	unsigned slot;
+
+	if (coremap_isdirty(paddr)) {
+		return;
+	}
+
+	frame = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&coremap_lock);
+	/* Only pages of shared mappings are written while shared */
+	KASSERT(coremap[frame].ce_refcount == 1 ||
+		coremap[frame].ce_slot == SWAP_NOSLOT);
+	coremap[frame].ce_flags |= CMF_DIRTY;
+	slot = coremap[frame].ce_slot;
+	coremap[frame].ce_slot = SWAP_NOSLOT;
+	spinlock_release(&coremap_lock);
+
+	if (slot != SWAP_NOSLOT) {
+		swap_free(slot);
+	}
+}
+
+/*
+ * The page has just been written to SLOT, or read from it, and the
+ * two are the same.
+ */
+void
+coremap_setclean(paddr_t paddr, unsigned slot)
+{
+	unsigned long frame;
+
+	frame = paddr / PAGE_SIZE;
+	KASSERT(frame >= coremap_firstframe && frame < coremap_nframes);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].ce_state == CME_USER);
+	KASSERT(coremap[frame].ce_slot == SWAP_NOSLOT);
+	coremap[frame].ce_flags &= ~CMF_DIRTY;
+	coremap[frame].ce_slot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Take away a clean page's swap slot, for its page table entry to
+ * hold once the page is evicted. Returns SWAP_NOSLOT if the page has
+ * never been in swap.
+ */
+unsigned
+coremap_takeslot(paddr_t paddr)
+{
+	unsigned long frame;
+	unsigned slot;
+
+	frame = paddr / PAGE_SIZE;
+	KASSERT(frame >= coremap_firstframe && frame < coremap_nframes);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].ce_state == CME_USER);
+	KASSERT(!(coremap[frame].ce_flags & CMF_DIRTY));
+	slot = coremap[frame].ce_slot;
+	coremap[frame].ce_slot = SWAP_NOSLOT;
+	spinlock_release(&coremap_lock);
+
+	return slot;
+}
+
+/*
+ * Write up to MAX dirty pages out to swap, starting at the clock
+ * hand, so they are clean by the time it gets to them. Pages that
+ * have been used recently are left alone; they'd probably just get
+ * dirty again. Returns the number of pages cleaned.
+ */
+unsigned
+coremap_clean(unsigned max)
+{
+	struct coremap_entry *ce;
+	struct addrspace *as;
+	vaddr_t vaddr;
+	unsigned long i, frame;
+	unsigned cleaned;
+	int result;
+
+	cleaned = 0;
+
+	spinlock_acquire(&coremap_lock);
+	frame = coremap_clockhand;
+	for (i = 0; i < coremap_nframes - coremap_firstframe && cleaned < max;
+	     i++) {
+		ce = &coremap[frame];
+		if (ce->ce_state == CME_USER && ce->ce_as != NULL &&
+		    ce->ce_refcount == 1 && !ce->ce_referenced &&
+		    (ce->ce_flags & (CMF_BUSY | CMF_DIRTY)) == CMF_DIRTY) {
+
+			ce->ce_flags |= CMF_BUSY;
+			as = ce->ce_as;
+			vaddr = ce->ce_vaddr;
+			spinlock_release(&coremap_lock);
+
+			result = vm_clean(as, vaddr, (paddr_t)frame * PAGE_SIZE);
+
+			spinlock_acquire(&coremap_lock);
+			ce->ce_flags &= ~CMF_BUSY;
+			wchan_wakeall(coremap_wchan, &coremap_lock);
+			if (result == 0) {
+				cleaned++;
+			}
+		}
+
+		frame++;
+		if (frame == coremap_nframes) {
+			frame = coremap_firstframe;
+		}
+	}
+	coremap_cleaned += cleaned;
+	spinlock_release(&coremap_lock);
+
+	return cleaned;
+}
+
+/*
+ * Free one page: an unused page cache page if there is one, otherwise
+ * evict a page and put its frame on the free list. Returns false
+ * if there was nothing to evict.
+ */
+bool
+coremap_reclaim(void)
+{
+	if (pagecache_reclaim(1) > 0) {
+		return true;
+	}
+	return coremap_evict(CME_FREE, NULL, 0) != CM_NOFRAME;
+}
+
+/*
+ * Block until fewer frames than the low watermark are free. The
+ * allocator wakes the pageout thread up whenever that happens.
+ */
+void
+coremap_pageout_wait(void)
+{
+	spinlock_acquire(&coremap_lock);
+	while (coremap_nfree() >= (long)coremap_lowater) {
+		wchan_sleep(coremap_pageout_wchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setlowater(unsigned long lowater)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap_lowater = lowater;
+	wchan_wakeone(coremap_pageout_wchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Read one of the global counts, hiding transient negative values.
+ */
+static
+unsigned long
+coremap_count(unsigned state)
+{
+	return coremap_counts[state] < 0 ? 0 : coremap_counts[state];
+}
+
+void
+coremap_getstats(struct coremap_stats *cs)
+{
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	spinlock_acquire(&coremap_lock);
+	if (coremap_ready) {
+		/* Include our own pending changes, at least */
+		coremap_pcpu_sync(&curcpu->c_coremap);
+	}
+	cs->cs_total = coremap_nframes;
+	cs->cs_free = coremap_count(CME_FREE);
+	cs->cs_cached = coremap_count(CME_CACHED);
+	cs->cs_fixed = coremap_count(CME_FIXED);
+	cs->cs_kernel = coremap_count(CME_KERNEL);
+	cs->cs_user = coremap_count(CME_USER);
+	cs->cs_zeroed = coremap_count(CME_ZERO);
+	cs->cs_refills = coremap_refills;
+	cs->cs_drains = coremap_drains;
+	cs->cs_scans = coremap_scans;
+	cs->cs_evictions = coremap_evictions;
+	cs->cs_cleaned = coremap_cleaned;
+	cs->cs_zerohits = coremap_zerohits;
+	cs->cs_zeromisses = coremap_zeromisses;
+	cs->cs_zerofilled = coremap_zerofilled;
+	for (i = 0; i < CM_NORDERS; i++) {
+		cs->cs_freeblocks[i] = coremap_freeblocks[i];
+	}
+	spinlock_release(&coremap_lock);
+	splx(spl);
+}
+
+void
+coremap_printstats(void)
+{
+	struct coremap_stats cs;
+
+	coremap_getstats(&cs);
+
+	kprintf("Coremap: %lu frames of %u bytes\n", cs.cs_total, PAGE_SIZE);
+	kprintf("    free:   %8lu\n", cs.cs_free);
+	kprintf("    cached: %8lu\n", cs.cs_cached);
+	kprintf("    fixed:  %8lu\n", cs.cs_fixed);
+	kprintf("    kernel: %8lu\n", cs.cs_kernel);
+	kprintf("    user:   %8lu\n", cs.cs_user);
+	kprintf("    zeroed: %8lu\n", cs.cs_zeroed);
+	kprintf("Per-CPU caches: %lu refills, %lu drains\n",
+		cs.cs_refills, cs.cs_drains);
+	kprintf("Eviction: %lu pages evicted, %lu frames scanned, "
+		"%lu pages cleaned ahead\n",
+		cs.cs_evictions, cs.cs_scans, cs.cs_cleaned);
+	kprintf("Zero pool: %lu hits, %lu misses (%lu%% hit), "
+		"%lu pages zeroed while idle\n",
+		cs.cs_zerohits, cs.cs_zeromisses,
+		cs.cs_zerohits + cs.cs_zeromisses == 0 ? 0 :
+		cs.cs_zerohits * 100 / (cs.cs_zerohits + cs.cs_zeromisses),
+		cs.cs_zerofilled);
+}
+
+void
+coremap_printfrag(void)
+{
+	struct coremap_stats cs;
+	unsigned long inblocks;
+	unsigned i, largest;
+
+	coremap_getstats(&cs);
+
+	kprintf("Free physical memory by buddy block size:\n");
+	kprintf("    order   pages  blocks\n");
+	inblocks = 0;
+	largest = CM_NORDERS;
+	for (i = 0; i < CM_NORDERS; i++) {
+		kprintf("    %5u %7u %7lu\n", i, 1U << i, cs.cs_freeblocks[i]);
+		inblocks += cs.cs_freeblocks[i] << i;
+		if (cs.cs_freeblocks[i] > 0) {
+			largest = i;
+		}
+	}
+	if (largest == CM_NORDERS) {
+		kprintf("No free blocks\n");
+		return;
+	}
+	/* How much of it a request for the largest block couldn't use */
+	kprintf("Largest free block: order %u (%u pages); %lu pages free in "
+		"blocks, %lu%% fragmented\n", largest, 1U << largest, inblocks,
+		100 - (cs.cs_freeblocks[largest] << largest) * 100 / inblocks);
+}
@@ -28,8 +28,16 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/kmprof.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <kmalloc.h>
 #include <vm.h>
 
 /*
@@ -121,6 +129,17 @@ fill_deadbeef(void *vptr, size_t len)
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+/*
+ * The per-cpu magazine layer hands out blocks without going through
+ * subpage_kmalloc, so it can't be used with the debugging modes that
+ * have to see every allocation.
+ */
+#if defined(GUARDS) || defined(LABELS)
+#undef MAGAZINES
+#else
+#define MAGAZINES
+#endif
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
@@ -131,6 +150,10 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #define SMALLEST_SUBPAGE_SIZE 16
 #define LARGEST_SUBPAGE_SIZE 2048
 
+#if NSIZES != KMALLOC_NSIZES
+#error "KMALLOC_NSIZES in kmalloc.h is out of date"
+#endif
+
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
 #else
@@ -145,7 +168,7 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *prev_samesize;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -160,10 +183,10 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages and their pagerefs. Most allocations
+ * and frees don't get this far: they are served by the per-cpu
+ * magazines further down, which only take a lock of their own when a
+ * cpu trades magazines with the depot.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -339,11 +362,142 @@ freepageref(struct pageref *p)
 ////////////////////////////////////////
 
 /*
- * Each pageref is on two linked lists: one list of pages of blocks of
- * that same size, and one of all blocks.
+ * Each pageref is on a doubly linked list of pages of blocks of that
+ * same size, so that it can be taken off in constant time.
  */
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+
+////////////////////////////////////////
+
+/*
+ * Table from heap pages to their pagerefs, so that kfree can find the
+ * page a block is on without searching.
+ *
+ * It is a two-level radix table indexed by physical page number: the
+ * top level is a static array of pointers to leaf pages, each of
+ * which holds the pagerefs for PRTAB_LEAFSIZE consecutive pages (4M
+ * of memory). Leaves are allocated the first time a heap page falls
+ * in their range and never freed, like pageref pages. Entries for
+ * pages that aren't subpage heap pages are NULL.
+ *
+ * Entries only change under kmalloc_spinlock, but they can be read
+ * without it: a block that is still allocated keeps its page, and its
+ * pageref's address and block type, from changing. The barriers make
+ * sure a reader that sees a leaf or an entry also sees its contents.
+ *
+ * The table covers as much physical memory as the kernel can address
+ * directly (kseg0 on MIPS); anything else isn't a heap page.
+ */
+
+#define PRTAB_MAXMEM    (512*1024*1024)
+#define PRTAB_LEAFSIZE  (PAGE_SIZE / sizeof(struct pageref *))
+#define PRTAB_NPAGES    (PRTAB_MAXMEM / PAGE_SIZE)
+#define PRTAB_NLEAVES   (PRTAB_NPAGES / PRTAB_LEAFSIZE)
+
+struct prtab_leaf {
+	struct pageref *refs[PRTAB_LEAFSIZE];
+};
+
+static struct prtab_leaf *volatile prtab[PRTAB_NLEAVES];
+
+/*
+ * Return the table index of the page containing ADDR, or PRTAB_NPAGES
+ * if it is outside the table.
+ */
+static
+inline
+unsigned long
+prtab_index(vaddr_t addr)
+{
+	paddr_t paddr;
+
+	paddr = KVADDR_TO_PADDR(addr);
+	if (addr < PADDR_TO_KVADDR(0) || paddr >= PRTAB_MAXMEM) {
+		return PRTAB_NPAGES;
+	}
+	return paddr / PAGE_SIZE;
+}
+
+/*
+ * Find the pageref for the heap page containing ADDR, or return NULL
+ * if ADDR isn't on a subpage heap page. Needs no lock if ADDR is in
+ * an allocated block.
+ */
+static
+struct pageref *
+prtab_lookup(vaddr_t addr)
+{
+	struct prtab_leaf *leaf;
+	struct pageref *pr;
+	unsigned long index;
+
+	index = prtab_index(addr);
+	if (index >= PRTAB_NPAGES) {
+		return NULL;
+	}
+	leaf = prtab[index / PRTAB_LEAFSIZE];
+	if (leaf == NULL) {
+		return NULL;
+	}
+	membar_load_load();
+	pr = leaf->refs[index % PRTAB_LEAFSIZE];
+	membar_load_load();
+	return pr;
+}
+
+/*
+ * Set the table entry for the heap page PRPAGE to PR (NULL to clear
+ * it). Called with kmalloc_spinlock held; when setting an entry it
+ * may have to let go of it to allocate a leaf. Returns nonzero if
+ * that fails.
+ */
+static
+int
+prtab_set(vaddr_t prpage, struct pageref *pr)
+{
+	struct prtab_leaf *leaf;
+	unsigned long index;
+	vaddr_t va;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	index = prtab_index(prpage);
+	KASSERT(index < PRTAB_NPAGES);
+
+	leaf = prtab[index / PRTAB_LEAFSIZE];
+	if (leaf == NULL) {
+		KASSERT(pr != NULL);
+
+		/* As in allocpagerefpage, don't hold the lock for this */
+		spinlock_release(&kmalloc_spinlock);
+		va = alloc_kpages(1);
+		if (va != 0) {
+			bzero((void *)va, PAGE_SIZE);
+		}
+		spinlock_acquire(&kmalloc_spinlock);
+		if (va == 0) {
+			kprintf("kmalloc: Couldn't get a pageref table page\n");
+			return -1;
+		}
+
+		leaf = prtab[index / PRTAB_LEAFSIZE];
+		if (leaf != NULL) {
+			/* Somebody else allocated it. */
+			spinlock_release(&kmalloc_spinlock);
+			free_kpages(va);
+			spinlock_acquire(&kmalloc_spinlock);
+		}
+		else {
+			leaf = (struct prtab_leaf *)va;
+			membar_store_store();
+			prtab[index / PRTAB_LEAFSIZE] = leaf;
+		}
+	}
+
+	membar_store_store();
+	leaf->refs[index % PRTAB_LEAFSIZE] = pr;
+	return 0;
+}
 
 ////////////////////////////////////////
 
@@ -588,18 +742,20 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
+			KASSERT(pr->next_samesize == NULL ||
+				pr->next_samesize->prev_samesize == pr);
+			KASSERT(prtab_lookup(PR_PAGEADDR(pr)) == pr);
 			KASSERT(sc < TOTAL_PAGEREFS);
 			sc++;
 		}
 	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		checksubpage(pr);
-		KASSERT(ac < TOTAL_PAGEREFS);
-		ac++;
+	for (i=0; i<NUM_PAGEREFPAGES; i++) {
+		ac += kheaproots[i].numinuse;
 	}
 
-	KASSERT(sc==ac);
+	/* a pageref can be in use and not on a list yet */
+	KASSERT(sc <= ac);
 }
 #else
 #define checksubpages()
@@ -794,6 +950,10 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+#ifdef MAGAZINES
+static void kmag_printstats(void);
+#endif
+
 /*
  * Print the whole heap.
  */
@@ -801,47 +961,51 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	int i;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		subpage_stats(pr);
+	for (i=0; i<NSIZES; i++) {
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			subpage_stats(pr);
+		}
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+#ifdef MAGAZINES
+	kmag_printstats();
+#endif
 }
 
 ////////////////////////////////////////
 
 /*
- * Remove a pageref from both lists that it's on.
+ * Remove a pageref from its size list and the pageref table.
  */
 static
 void
 remove_lists(struct pageref *pr, int blktype)
 {
-	struct pageref **guy;
-
 	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	if (pr->prev_samesize != NULL) {
+		pr->prev_samesize->next_samesize = pr->next_samesize;
 	}
-
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+	else {
+		KASSERT(sizebases[blktype] == pr);
+		sizebases[blktype] = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
 	}
+
+	/* Clearing an entry doesn't need to allocate */
+	(void)prtab_set(PR_PAGEADDR(pr), NULL);
 }
 
 /*
@@ -1007,12 +1171,21 @@ subpage_kmalloc(size_t sz
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
+	/* This may drop the lock, so do it before anyone can see pr */
+	if (prtab_set(prpage, pr)) {
+		freepageref(pr);
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(prpage);
+		return NULL;
+	}
+
+	pr->prev_samesize = NULL;
 	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr;
+	}
 	sizebases[blktype] = pr;
 
-	pr->next_all = allbase;
-	allbase = pr;
-
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
@@ -1065,30 +1238,21 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = prtab_lookup(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1159,28 +1323,758 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+//
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazines.
+//
+// A magazine is an array of up to KMAG_ROUNDS free blocks of one
+// size. Each cpu has two for each size (see kmalloc.h); allocating
+// pops a block from the loaded one, freeing pushes one onto it, and
+// when it runs out (or fills up) the cpu tries the previous one
+// before going to the depot. Having two means a cpu alternating
+// between allocating and freeing right at a magazine boundary doesn't
+// go to the depot every time.
+//
+// The depot keeps full and empty magazines for each size under its
+// own lock. It holds on to at most KMAG_DEPOTMAX full ones per size;
+// beyond that the blocks go back to their pages, so that pages can
+// still become entirely free and be released. Likewise it keeps at
+// most KMAG_DEPOTMAX empty ones and frees the rest.
+//
+// Blocks sitting in magazines count as allocated as far as the
+// subpage allocator is concerned. Magazines themselves are ordinary
+// subpage blocks.
+//
+
+#ifdef MAGAZINES
+
+struct kmag {
+	struct kmag *next;		/* on a depot list */
+	unsigned rounds;		/* number of blocks in objs[] */
+	void *objs[KMAG_ROUNDS];
+};
+
+struct kmag_depot {
+	struct kmag *full;
+	struct kmag *empty;
+	unsigned nfull;
+	unsigned nempty;
+};
+
+static struct kmag_depot depots[NSIZES];
+static unsigned long kmag_exchanges;	/* magazines swapped with depot */
+static struct spinlock kmag_depot_lock = SPINLOCK_INITIALIZER;
+
+void
+kmalloc_pcpu_init(struct kmalloc_pcpu *kp)
+{
+	unsigned i;
+
+	for (i=0; i<KMALLOC_NSIZES; i++) {
+		kp->kp_loaded[i] = NULL;
+		kp->kp_previous[i] = NULL;
+	}
+	kp->kp_hits = 0;
+	kp->kp_misses = 0;
+}
+
+/*
+ * Depot list manipulation. Called with kmag_depot_lock held.
+ */
+static
+void
+depot_push(struct kmag **list, unsigned *count, struct kmag *mag)
+{
+	mag->next = *list;
+	*list = mag;
+	(*count)++;
+}
+
+static
+struct kmag *
+depot_pop(struct kmag **list, unsigned *count)
+{
+	struct kmag *mag;
+
+	mag = *list;
+	if (mag != NULL) {
+		*list = mag->next;
+		(*count)--;
+	}
+	return mag;
+}
+
+/*
+ * Give all the blocks in a magazine back to their pages, and free the
+ * magazine.
+ */
+static
+void
+kmag_destroy(struct kmag *mag)
+{
+	unsigned i;
+
+	for (i=0; i<mag->rounds; i++) {
+		if (subpage_kfree(mag->objs[i])) {
+			panic("kmag_destroy: block %p not on a heap page\n",
+			      mag->objs[i]);
+		}
+	}
+	if (subpage_kfree(mag)) {
+		panic("kmag_destroy: magazine %p not on a heap page\n", mag);
+	}
+}
+
+/*
+ * Allocate a block of type BLKTYPE from this cpu's magazines.
+ * Returns NULL if they and the depot are out, in which case the
+ * caller should go to the pages.
+ */
+static
+void *
+mag_kmalloc(int blktype)
+{
+	struct kmalloc_pcpu *kp;
+	struct kmag *mag, *full, *excess;
+	struct kmag_depot *depot;
+	void *ret;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* Too early in boot */
+		return NULL;
+	}
+
+	excess = NULL;		/* an empty one the depot had no room for */
+
+	spl = splhigh();
+	kp = &curcpu->c_kmalloc;
+
+	mag = kp->kp_loaded[blktype];
+	if (mag == NULL || mag->rounds == 0) {
+		mag = kp->kp_previous[blktype];
+		if (mag != NULL && mag->rounds > 0) {
+			kp->kp_previous[blktype] = kp->kp_loaded[blktype];
+			kp->kp_loaded[blktype] = mag;
+		}
+		else {
+			/* Trade the empty previous one for a full one */
+			depot = &depots[blktype];
+			spinlock_acquire(&kmag_depot_lock);
+			full = depot_pop(&depot->full, &depot->nfull);
+			if (full != NULL) {
+				if (mag == NULL) {
+					/* nothing to trade */
+				}
+				else if (depot->nempty < KMAG_DEPOTMAX) {
+					depot_push(&depot->empty,
+						   &depot->nempty, mag);
+				}
+				else {
+					excess = mag;
+				}
+				kp->kp_previous[blktype] =
+					kp->kp_loaded[blktype];
+				kp->kp_loaded[blktype] = full;
+				kmag_exchanges++;
+			}
+			spinlock_release(&kmag_depot_lock);
+
+			if (full == NULL) {
+				kp->kp_misses++;
+				splx(spl);
+				return NULL;
+			}
+			mag = full;
+		}
+	}
+
+	ret = mag->objs[--mag->rounds];
+	kp->kp_hits++;
+	splx(spl);
+
+	if (excess != NULL) {
+		kmag_destroy(excess);
+	}
+	return ret;
+}
+
+/*
+ * Free a block of type BLKTYPE into this cpu's magazines. Returns
+ * nonzero if there was no room, in which case the caller should
+ * give it back to its page.
+ */
+static
+int
+mag_kfree(void *ptr, int blktype)
+{
+	struct kmalloc_pcpu *kp;
+	struct kmag *mag, *spare, *excess;
+	struct kmag_depot *depot;
+	bool triedalloc;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return -1;
+	}
+
+	depot = &depots[blktype];
+	spare = NULL;		/* an empty magazine we made ourselves */
+	excess = NULL;		/* a full one the depot had no room for */
+	triedalloc = false;
+
+	fill_deadbeef(ptr, sizes[blktype]);
+
+ again:
+	spl = splhigh();
+	kp = &curcpu->c_kmalloc;
+
+	mag = kp->kp_loaded[blktype];
+	if (mag == NULL || mag->rounds == KMAG_ROUNDS) {
+		mag = kp->kp_previous[blktype];
+		if (mag != NULL && mag->rounds < KMAG_ROUNDS) {
+			kp->kp_previous[blktype] = kp->kp_loaded[blktype];
+			kp->kp_loaded[blktype] = mag;
+		}
+		else {
+			/* Trade the full previous one for an empty one */
+			spinlock_acquire(&kmag_depot_lock);
+			if (spare == NULL) {
+				spare = depot_pop(&depot->empty,
+						  &depot->nempty);
+			}
+			if (spare != NULL) {
+				if (mag == NULL) {
+					/* nothing to trade */
+				}
+				else if (depot->nfull < KMAG_DEPOTMAX) {
+					depot_push(&depot->full,
+						   &depot->nfull, mag);
+				}
+				else {
+					excess = mag;
+				}
+				kp->kp_previous[blktype] =
+					kp->kp_loaded[blktype];
+				kp->kp_loaded[blktype] = spare;
+				spare = NULL;
+				kmag_exchanges++;
+			}
+			spinlock_release(&kmag_depot_lock);
+
+			mag = kp->kp_loaded[blktype];
+			if (mag == NULL || mag->rounds == KMAG_ROUNDS) {
+				/* No empty magazine anywhere */
+				splx(spl);
+				if (triedalloc) {
+					return -1;
+				}
+				triedalloc = true;
+				spare = subpage_kmalloc(sizeof(struct kmag));
+				if (spare == NULL) {
+					return -1;
+				}
+				spare->rounds = 0;
+				goto again;
+			}
+		}
+	}
+
+	mag->objs[mag->rounds++] = ptr;
+	splx(spl);
+
+	if (spare != NULL) {
+		/* We made one but ended up not needing it */
+		spinlock_acquire(&kmag_depot_lock);
+		if (depot->nempty < KMAG_DEPOTMAX) {
+			depot_push(&depot->empty, &depot->nempty, spare);
+			spare = NULL;
+		}
+		spinlock_release(&kmag_depot_lock);
+		if (spare != NULL) {
+			kmag_destroy(spare);
+		}
+	}
+	if (excess != NULL) {
+		kmag_destroy(excess);
+	}
+	return 0;
+}
+
+/*
+ * Find the block type of a subpage block, or return -1 if PTR is not
+ * on any heap page. This takes no lock; see prtab above.
+ */
+static
+int
+subpage_blktype(void *ptr)
+{
+	struct pageref *pr;
+	vaddr_t ptraddr, prpage;
+	int blktype;
+
+	ptraddr = (vaddr_t)ptr;
+
+	pr = prtab_lookup(ptraddr);
+	if (pr == NULL) {
+		return -1;
+	}
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+	if ((ptraddr - prpage) % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+	return blktype;
+}
+
+/*
+ * Print what the magazine layer holds.
+ */
+static
+void
+kmag_printstats(void)
+{
+	struct cpu *c;
+	unsigned long hits, misses;
+	unsigned i, full, empty;
+
+	hits = misses = 0;
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		hits += c->c_kmalloc.kp_hits;
+		misses += c->c_kmalloc.kp_misses;
+	}
+
+	spinlock_acquire(&kmag_depot_lock);
+	kprintf("Magazines: %lu allocations from magazines, %lu from pages, "
+		"%lu depot exchanges\n", hits, misses, kmag_exchanges);
+	kprintf("   depot:");
+	for (i=0; i<NSIZES; i++) {
+		full = depots[i].nfull;
+		empty = depots[i].nempty;
+		kprintf(" %lu:%u/%u", (unsigned long)sizes[i], full, empty);
+	}
+	kprintf(" (size:full/empty)\n");
+	spinlock_release(&kmag_depot_lock);
+}
+
+#else /* !MAGAZINES */
+
+void
+kmalloc_pcpu_init(struct kmalloc_pcpu *kp)
+{
+	(void)kp;
+}
+
+#endif /* MAGAZINES */
+
+//
+////////////////////////////////////////////////////////////
+//
+// Profiler.
+//
+// While it's on, kmalloc counts each allocation against its call
+// site (kmalloc's return address) and its size class, and enters the
+// block in a hash table keyed by address so that kfree can charge the
+// free back to the same site and size. That is how live bytes per
+// call site are kept. The table has room for KMPROF_NTRACK blocks;
+// allocations beyond that are still counted but can't be charged when
+// freed, and kp_untracked says how many there were. Frees go on being
+// charged after the profiler is stopped, as long as there are blocks
+// in the table, so live bytes stay right; KMPROF_RESET forgets
+// everything.
+//
+// Allocations made through kstrdup and other wrappers are charged to
+// the wrapper. Look the call sites up with os161-addr2line.
+//
+// When the profiler is off and the table is empty, it costs kmalloc
+// and kfree one test each.
+//
+
+#if KMPROF_NSIZES != NSIZES + 1
+#error "KMPROF_NSIZES should be NSIZES plus one for whole pages"
+#endif
+
+#define KMPROF_TRACKBITS 12
+#define KMPROF_NTRACK    (1 << KMPROF_TRACKBITS)
+#define KMPROF_MAXTRACK  (KMPROF_NTRACK / 4 * 3)	/* keep probes short */
+#define KMPROF_SITEHASH  128	/* more than KMPROF_MAXSITES */
+#define KMPROF_NOSITE    0xff
+
+struct kmprof_block {
+	vaddr_t kb_addr;		/* 0 if the slot is empty */
+	uint32_t kb_bytes;
+	uint8_t kb_site;		/* index into kp_sites, or KMPROF_NOSITE */
+	uint8_t kb_sizeclass;
+};
+
+#define KMPROF_TRACKPAGES \
+	DIVROUNDUP(KMPROF_NTRACK * sizeof(struct kmprof_block), PAGE_SIZE)
+
+static struct spinlock kmprof_lock = SPINLOCK_INITIALIZER;
+static volatile bool kmprof_on;
+static volatile unsigned kmprof_ntracked;
+static struct kmprof_block *kmprof_blocks;	/* never freed */
+static struct kmprof_stats kmprof_stats;
+static uint8_t kmprof_sitehash[KMPROF_SITEHASH];	/* site index + 1 */
+static struct timespec kmprof_since;		/* when last started */
+
+static
+inline
+unsigned
+kmprof_blockhash(vaddr_t addr)
+{
+	return ((uint32_t)(addr >> 4) * 2654435761U) >> (32 - KMPROF_TRACKBITS);
+}
+
+/*
+ * Milliseconds since the profiler was last started.
+ */
+static
+uint32_t
+kmprof_elapsed(void)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, &kmprof_since, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+}
+
+/*
+ * Find the entry for a call site, making one if there is room.
+ * Returns KMPROF_NOSITE if there isn't. Called with kmprof_lock held.
+ */
+static
+unsigned
+kmprof_findsite(vaddr_t callsite)
+{
+	struct kmprof_site *ks;
+	unsigned h, i;
+
+	h = (callsite >> 2) % KMPROF_SITEHASH;
+	while (kmprof_sitehash[h] != 0) {
+		i = kmprof_sitehash[h] - 1;
+		if (kmprof_stats.kp_sites[i].ks_callsite == callsite) {
+			return i;
+		}
+		h = (h + 1) % KMPROF_SITEHASH;
+	}
+
+	if (kmprof_stats.kp_nsites == KMPROF_MAXSITES) {
+		return KMPROF_NOSITE;
+	}
+	i = kmprof_stats.kp_nsites++;
+	ks = &kmprof_stats.kp_sites[i];
+	bzero(ks, sizeof(*ks));
+	ks->ks_callsite = callsite;
+	kmprof_sitehash[h] = i + 1;
+	return i;
+}
+
+/*
+ * Record an allocation of SZ bytes at PTR from CALLSITE, of size class
+ * SIZECLASS (index into sizes[], or NSIZES for whole pages).
+ */
+static
+void
+kmprof_alloc(void *ptr, size_t sz, unsigned sizeclass, vaddr_t callsite)
+{
+	struct kmprof_site *ks;
+	struct kmprof_block *kb;
+	unsigned site, h;
+
+	spinlock_acquire(&kmprof_lock);
+	if (!kmprof_on) {
+		spinlock_release(&kmprof_lock);
+		return;
+	}
+
+	kmprof_stats.kp_sizes[sizeclass].kz_allocs++;
+
+	site = kmprof_findsite(callsite);
+	if (site == KMPROF_NOSITE) {
+		kmprof_stats.kp_lostsites++;
+		ks = NULL;
+	}
+	else {
+		ks = &kmprof_stats.kp_sites[site];
+		ks->ks_allocs++;
+		ks->ks_totalbytes += sz;
+	}
+
+	if (kmprof_ntracked >= KMPROF_MAXTRACK) {
+		kmprof_stats.kp_untracked++;
+		spinlock_release(&kmprof_lock);
+		return;
+	}
+
+	h = kmprof_blockhash((vaddr_t)ptr);
+	while (kmprof_blocks[h].kb_addr != 0 &&
+	       kmprof_blocks[h].kb_addr != (vaddr_t)ptr) {
+		h = (h + 1) % KMPROF_NTRACK;
+	}
+	kb = &kmprof_blocks[h];
+	if (kb->kb_addr != 0) {
+		/*
+		 * Still here from before; it must have been freed
+		 * without kfree (e.g. with free_kpages). Forget it.
+		 */
+		if (kb->kb_site != KMPROF_NOSITE) {
+			kmprof_stats.kp_sites[kb->kb_site].ks_livebytes -=
+				kb->kb_bytes;
+		}
+		kmprof_ntracked--;
+	}
+	kb->kb_addr = (vaddr_t)ptr;
+	kb->kb_bytes = sz;
+	kb->kb_site = site;
+	kb->kb_sizeclass = sizeclass;
+	kmprof_ntracked++;
+	if (ks != NULL) {
+		ks->ks_livebytes += sz;
+	}
+
+	spinlock_release(&kmprof_lock);
+}
+
+/*
+ * Charge the free of PTR, if we have it, and take it out of the table.
+ * Called before the block is actually freed, so nobody can allocate
+ * it again meanwhile.
+ */
+static
+void
+kmprof_free(void *ptr)
+{
+	struct kmprof_block *kb;
+	struct kmprof_site *ks;
+	unsigned h, i, j, k;
+
+	spinlock_acquire(&kmprof_lock);
+
+	h = kmprof_blockhash((vaddr_t)ptr);
+	while (kmprof_blocks[h].kb_addr != (vaddr_t)ptr) {
+		if (kmprof_blocks[h].kb_addr == 0) {
+			/* Not one of ours */
+			spinlock_release(&kmprof_lock);
+			return;
+		}
+		h = (h + 1) % KMPROF_NTRACK;
+	}
+
+	kb = &kmprof_blocks[h];
+	kmprof_stats.kp_sizes[kb->kb_sizeclass].kz_frees++;
+	if (kb->kb_site != KMPROF_NOSITE) {
+		ks = &kmprof_stats.kp_sites[kb->kb_site];
+		ks->ks_frees++;
+		KASSERT(ks->ks_livebytes >= kb->kb_bytes);
+		ks->ks_livebytes -= kb->kb_bytes;
+	}
+	kmprof_ntracked--;
+
+	/*
+	 * Empty the slot, moving later entries of the same probe run
+	 * back into it when their home slot allows, so lookups never
+	 * stop early at a hole.
+	 */
+	i = h;
+	while (1) {
+		kmprof_blocks[i].kb_addr = 0;
+		j = i;
+		while (1) {
+			j = (j + 1) % KMPROF_NTRACK;
+			if (kmprof_blocks[j].kb_addr == 0) {
+				spinlock_release(&kmprof_lock);
+				return;
+			}
+			k = kmprof_blockhash(kmprof_blocks[j].kb_addr);
+			/* Leave it if its home is cyclically in (i, j] */
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+				continue;
+			}
+			break;
+		}
+		kmprof_blocks[i] = kmprof_blocks[j];
+		i = j;
+	}
+}
+
+int
+kmprof_control(int op)
+{
+	vaddr_t va;
+
+	switch (op) {
+	    case KMPROF_GET:
+		break;
+
+	    case KMPROF_START:
+		va = 0;
+		if (kmprof_blocks == NULL) {
+			va = alloc_kpages(KMPROF_TRACKPAGES);
+			if (va == 0) {
+				return ENOMEM;
+			}
+			bzero((void *)va, KMPROF_TRACKPAGES * PAGE_SIZE);
+		}
+		spinlock_acquire(&kmprof_lock);
+		if (kmprof_blocks == NULL) {
+			kmprof_blocks = (struct kmprof_block *)va;
+			va = 0;
+		}
+		if (!kmprof_on) {
+			gettime(&kmprof_since);
+			kmprof_on = true;
+		}
+		spinlock_release(&kmprof_lock);
+		if (va != 0) {
+			/* Somebody else got there first */
+			free_kpages(va);
+		}
+		break;
+
+	    case KMPROF_STOP:
+		spinlock_acquire(&kmprof_lock);
+		if (kmprof_on) {
+			kmprof_stats.kp_msecs += kmprof_elapsed();
+			kmprof_on = false;
+		}
+		spinlock_release(&kmprof_lock);
+		break;
+
+	    case KMPROF_RESET:
+		spinlock_acquire(&kmprof_lock);
+		bzero(&kmprof_stats, sizeof(kmprof_stats));
+		bzero(kmprof_sitehash, sizeof(kmprof_sitehash));
+		if (kmprof_blocks != NULL) {
+			bzero(kmprof_blocks,
+			      KMPROF_NTRACK * sizeof(struct kmprof_block));
+		}
+		kmprof_ntracked = 0;
+		gettime(&kmprof_since);
+		spinlock_release(&kmprof_lock);
+		break;
+
+	    default:
+		return EINVAL;
+	}
+	return 0;
+}
+
+void
+kmprof_getstats(struct kmprof_stats *ks)
+{
+	unsigned i;
+
+	spinlock_acquire(&kmprof_lock);
+	*ks = kmprof_stats;
+	ks->kp_enabled = kmprof_on;
+	if (kmprof_on) {
+		ks->kp_msecs += kmprof_elapsed();
+	}
+	spinlock_release(&kmprof_lock);
+
+	for (i=0; i<NSIZES; i++) {
+		ks->kp_sizes[i].kz_size = sizes[i];
+	}
+	ks->kp_sizes[NSIZES].kz_size = 0;
+}
+
+void
+kmprof_printstats(void)
+{
+	struct kmprof_stats *ks;
+	struct kmprof_site *site;
+	uint8_t order[KMPROF_MAXSITES], tmp;
+	unsigned i, j, best;
+	uint32_t secs;
+
+	/* Too big for the stack */
+	ks = kmalloc(sizeof(*ks));
+	if (ks == NULL) {
+		kprintf("kmprof: Out of memory\n");
+		return;
+	}
+	kmprof_getstats(ks);
+
+	secs = ks->kp_msecs / 1000;
+	kprintf("kmalloc profiler: %s, %u.%03u s recorded\n",
+		ks->kp_enabled ? "on" : "off", secs, ks->kp_msecs % 1000);
+
+	kprintf("    %-6s %10s %10s %10s\n", "size", "allocs", "frees",
+		"allocs/s");
+	for (i=0; i<KMPROF_NSIZES; i++) {
+		if (ks->kp_sizes[i].kz_size == 0) {
+			kprintf("    %-6s", "pages");
+		}
+		else {
+			kprintf("    %-6u", ks->kp_sizes[i].kz_size);
+		}
+		kprintf(" %10u %10u %10u\n", ks->kp_sizes[i].kz_allocs,
+			ks->kp_sizes[i].kz_frees,
+			ks->kp_msecs == 0 ? 0 :
+			(unsigned)((uint64_t)ks->kp_sizes[i].kz_allocs * 1000
+				   / ks->kp_msecs));
+	}
+
+	/* Busiest call sites first */
+	for (i=0; i<ks->kp_nsites; i++) {
+		order[i] = i;
+	}
+	for (i=0; i<ks->kp_nsites; i++) {
+		best = i;
+		for (j=i+1; j<ks->kp_nsites; j++) {
+			if (ks->kp_sites[order[j]].ks_allocs >
+			    ks->kp_sites[order[best]].ks_allocs) {
+				best = j;
+			}
+		}
+		tmp = order[i];
+		order[i] = order[best];
+		order[best] = tmp;
+	}
+
+	kprintf("    %-10s %10s %10s %10s %10s\n", "callsite", "allocs",
+		"frees", "live", "bytes");
+	for (i=0; i<ks->kp_nsites; i++) {
+		site = &ks->kp_sites[order[i]];
+		kprintf("    0x%08x %10u %10u %10u %10u\n", site->ks_callsite,
+			site->ks_allocs, site->ks_frees, site->ks_livebytes,
+			site->ks_totalbytes);
+	}
+	if (ks->kp_lostsites > 0) {
+		kprintf("    %u allocations from call sites not shown\n",
+			ks->kp_lostsites);
+	}
+	if (ks->kp_untracked > 0) {
+		kprintf("    %u blocks not tracked to their frees\n",
+			ks->kp_untracked);
+	}
+
+	kfree(ks);
+}
+
 //
 ////////////////////////////////////////////////////////////
 
 /*
  * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
+ * alloc_kpages depending on how big SZ is. LABEL is the caller of
+ * kmalloc.
  */
+static
 void *
-kmalloc(size_t sz)
+kmalloc_block(size_t sz, vaddr_t label)
 {
 	size_t checksz;
-#ifdef LABELS
-	vaddr_t label;
-#endif
 
-#ifdef LABELS
-#ifdef __GNUC__
-	label = (vaddr_t)__builtin_return_address(0);
-#else
-#error "Don't know how to get return address with this compiler"
-#endif /* __GNUC__ */
-#endif /* LABELS */
+#ifndef LABELS
+	(void)label;
+#endif
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
@@ -1198,6 +2092,17 @@ kmalloc(size_t sz)
 		return (void *)address;
 	}
 
+#ifdef MAGAZINES
+	{
+		void *ptr;
+
+		ptr = mag_kmalloc(blocktype(sz));
+		if (ptr != NULL) {
+			return ptr;
+		}
+	}
+#endif
+
 #ifdef LABELS
 	return subpage_kmalloc(sz, label);
 #else
@@ -1205,6 +2110,28 @@ kmalloc(size_t sz)
 #endif
 }
 
+void *
+kmalloc(size_t sz)
+{
+	vaddr_t callsite;
+	size_t checksz;
+	void *ptr;
+
+#ifdef __GNUC__
+	callsite = (vaddr_t)__builtin_return_address(0);
+#else
+#error "Don't know how to get return address with this compiler"
+#endif /* __GNUC__ */
+
+	ptr = kmalloc_block(sz, callsite);
+	if (ptr != NULL && kmprof_on) {
+		checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
+		kmprof_alloc(ptr, sz, checksz >= LARGEST_SUBPAGE_SIZE ?
+			     NSIZES : blocktype(checksz), callsite);
+	}
+	return ptr;
+}
+
 /*
  * Free a block previously returned from kmalloc.
  */
@@ -1216,7 +2143,21 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	if (kmprof_ntracked > 0) {
+		kmprof_free(ptr);
+	}
+#ifdef MAGAZINES
+	{
+		int blktype;
+
+		blktype = subpage_blktype(ptr);
+		if (blktype >= 0 && mag_kfree(ptr, blktype) == 0) {
+			return;
+		}
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
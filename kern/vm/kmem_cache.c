@@ -0,0 +1,357 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+/*
+ * Object caches. See kmem_cache.h.
+ *
+ * A slab is one page. Its bookkeeping (struct kmem_slab) sits at the
+ * end of the page, so kmem_cache_free finds it from the object's
+ * address alone. The objects start at the slab's color offset and
+ * follow each other every kc_stride bytes. Each object has a link
+ * word after it for the slab's free list; keeping it out of the
+ * object itself is what lets constructed state survive being freed.
+ *
+ * Each cache keeps its slabs on three lists by how many objects are
+ * in use, and allocates from partly used slabs first so that the
+ * others can empty out. It holds on to one empty slab, so that an
+ * object allocated and freed over and over doesn't make and destroy
+ * a slab every time; further empty slabs are given back at once.
+ */
+
+#define KMEM_DEFALIGN	8
+#define KMEM_COLORSTEP	32	/* A processor cache line */
+#define KMEM_MAXEMPTY	1
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;	/* On one of the cache's lists */
+	struct kmem_slab *ks_prev;
+	struct kmem_cache *ks_cache;
+	void *ks_free;			/* Free objects */
+	unsigned ks_inuse;
+	unsigned ks_color;		/* Offset of the first object */
+};
+
+#define KMEM_SLAB(obj) \
+	((struct kmem_slab *)(((vaddr_t)(obj) & PAGE_FRAME) + PAGE_SIZE - \
+			      sizeof(struct kmem_slab)))
+
+#define KMEM_LINK(kc, obj) (*(void **)((char *)(obj) + (kc)->kc_linkoff))
+
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+/*
+ * The list a slab with INUSE objects allocated belongs on.
+ */
+static
+struct kmem_slab **
+kmem_slab_list(struct kmem_cache *kc, unsigned inuse)
+{
+	if (inuse == 0) {
+		return &kc->kc_empty;
+	}
+	if (inuse == kc->kc_perslab) {
+		return &kc->kc_full;
+	}
+	return &kc->kc_partial;
+}
+
+/*
+ * Slab list manipulation. Called with kc_lock held.
+ */
+static
+void
+kmem_slab_insert(struct kmem_slab **head, struct kmem_slab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = *head;
+	if (*head != NULL) {
+		(*head)->ks_prev = ks;
+	}
+	*head = ks;
+}
+
+static
+void
+kmem_slab_remove(struct kmem_slab **head, struct kmem_slab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(*head == ks);
+		*head = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_next = ks->ks_prev = NULL;
+}
+
+/*
+ * Move a slab whose use count just changed from OLDINUSE to the list
+ * it now belongs on. Called with kc_lock held.
+ */
+static
+void
+kmem_slab_moved(struct kmem_cache *kc, struct kmem_slab *ks,
+		unsigned oldinuse)
+{
+	struct kmem_slab **from, **to;
+
+	from = kmem_slab_list(kc, oldinuse);
+	to = kmem_slab_list(kc, ks->ks_inuse);
+	if (from != to) {
+		kmem_slab_remove(from, ks);
+		kmem_slab_insert(to, ks);
+		if (from == &kc->kc_empty) {
+			kc->kc_nempty--;
+		}
+		if (to == &kc->kc_empty) {
+			kc->kc_nempty++;
+		}
+	}
+}
+
+/*
+ * Make a new slab for KC, constructing all its objects.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	char *obj;
+	unsigned i, color;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	color = kc->kc_nextcolor;
+	kc->kc_nextcolor += KMEM_COLORSTEP;
+	if (kc->kc_nextcolor > kc->kc_maxcolor) {
+		kc->kc_nextcolor = 0;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	ks = KMEM_SLAB(page);
+	ks->ks_next = ks->ks_prev = NULL;
+	ks->ks_cache = kc;
+	ks->ks_free = NULL;
+	ks->ks_inuse = 0;
+	ks->ks_color = color;
+
+	/* Chain them so that the lowest comes out first */
+	for (i = kc->kc_perslab; i > 0; i--) {
+		obj = (char *)page + color + (i - 1) * kc->kc_stride;
+		if (kc->kc_ctor != NULL) {
+			kc->kc_ctor(obj);
+		}
+		KMEM_LINK(kc, obj) = ks->ks_free;
+		ks->ks_free = obj;
+	}
+
+	return ks;
+}
+
+/*
+ * Destroy an empty slab that is on no list.
+ */
+static
+void
+kmem_slab_destroy(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	vaddr_t page;
+	unsigned i;
+
+	KASSERT(ks->ks_inuse == 0);
+
+	page = (vaddr_t)ks & PAGE_FRAME;
+	if (kc->kc_dtor != NULL) {
+		for (i = 0; i < kc->kc_perslab; i++) {
+			kc->kc_dtor((char *)page + ks->ks_color + i * kc->kc_stride);
+		}
+	}
+	free_kpages(page);
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+	size_t room;
+
+	if (align == 0) {
+		align = KMEM_DEFALIGN;
+	}
+	KASSERT((align & (align - 1)) == 0 && align <= KMEM_COLORSTEP);
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_align = align;
+	kc->kc_linkoff = ROUNDUP(size, sizeof(void *));
+	kc->kc_stride = ROUNDUP(kc->kc_linkoff + sizeof(void *), align);
+
+	room = PAGE_SIZE - sizeof(struct kmem_slab);
+	kc->kc_perslab = room / kc->kc_stride;
+	if (kc->kc_perslab == 0) {
+		kfree(kc);
+		return NULL;
+	}
+	/* Color with whatever the objects leave over */
+	kc->kc_maxcolor = room - kc->kc_perslab * kc->kc_stride;
+	kc->kc_maxcolor -= kc->kc_maxcolor % align;
+	kc->kc_nextcolor = 0;
+
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = kc->kc_full = kc->kc_empty = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_inuse = 0;
+	kc->kc_allocs = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **p;
+	struct kmem_slab *ks;
+
+	KASSERT(kc->kc_inuse == 0);
+	KASSERT(kc->kc_partial == NULL && kc->kc_full == NULL);
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (p = &kmem_caches; *p != kc; p = &(*p)->kc_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	while ((ks = kc->kc_empty) != NULL) {
+		kmem_slab_remove(&kc->kc_empty, ks);
+		kmem_slab_destroy(kc, ks);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	unsigned oldinuse;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	ks = (kc->kc_partial != NULL) ? kc->kc_partial : kc->kc_empty;
+	if (ks == NULL) {
+		/* Make a slab without holding the lock */
+		spinlock_release(&kc->kc_lock);
+		ks = kmem_slab_create(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kmem_slab_insert(&kc->kc_empty, ks);
+		kc->kc_nslabs++;
+		kc->kc_nempty++;
+	}
+
+	obj = ks->ks_free;
+	KASSERT(obj != NULL);
+	ks->ks_free = KMEM_LINK(kc, obj);
+	oldinuse = ks->ks_inuse++;
+	kmem_slab_moved(kc, ks, oldinuse);
+	kc->kc_inuse++;
+	kc->kc_allocs++;
+
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+	vaddr_t offset;
+	unsigned oldinuse;
+
+	ks = KMEM_SLAB(obj);
+	KASSERT(ks->ks_cache == kc);
+	offset = ((vaddr_t)obj & ~(vaddr_t)PAGE_FRAME) - ks->ks_color;
+	if (offset % kc->kc_stride != 0 ||
+	    offset / kc->kc_stride >= kc->kc_perslab) {
+		panic("kmem_cache_free: %s: bad object %p\n", kc->kc_name, obj);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(ks->ks_inuse > 0);
+	KMEM_LINK(kc, obj) = ks->ks_free;
+	ks->ks_free = obj;
+	oldinuse = ks->ks_inuse--;
+	kmem_slab_moved(kc, ks, oldinuse);
+	kc->kc_inuse--;
+
+	if (ks->ks_inuse == 0 && kc->kc_nempty > KMEM_MAXEMPTY) {
+		kmem_slab_remove(&kc->kc_empty, ks);
+		kc->kc_nempty--;
+		kc->kc_nslabs--;
+		spinlock_release(&kc->kc_lock);
+		kmem_slab_destroy(kc, ks);
+		return;
+	}
+
+	spinlock_release(&kc->kc_lock);
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned long inuse, allocs;
+	unsigned nslabs;
+
+	kprintf("Object caches:\n");
+	kprintf("    %-16s %5s %6s %5s %6s %7s %7s %10s\n", "name", "size",
+		"stride", "/slab", "slabs", "inuse", "total", "allocs");
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		nslabs = kc->kc_nslabs;
+		inuse = kc->kc_inuse;
+		allocs = kc->kc_allocs;
+		spinlock_release(&kc->kc_lock);
+
+		kprintf("    %-16s %5lu %6lu %5u %6u %7lu %7lu %10lu\n",
+			kc->kc_name, (unsigned long)kc->kc_size,
+			(unsigned long)kc->kc_stride, kc->kc_perslab, nslabs,
+			inuse, (unsigned long)nslabs * kc->kc_perslab, allocs);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
@@ -0,0 +1,536 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <stat.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+
+/*
+ * Shared file page cache. See pagecache.h.
+ *
+ * Pages are kept in a hash table keyed by vnode and page number, and
+ * each vnode also chains its own pages together (vn_pagecache) so
+ * they can be purged without searching the whole table. Everything
+ * is protected by one spinlock; reading a page in happens without
+ * it, and if two threads race to read the same page the loser just
+ * throws its copy away.
+ *
+ * A cached frame is an ownerless user page, so the coremap never
+ * picks it for eviction by itself. Its reference count is one for
+ * the cache plus one per mapping; pagecache_reclaim frees the ones
+ * with no mappings. Since new mappings only come from
+ * pagecache_get, which holds the lock, or from forking an address
+ * space that already maps the page, a count of one can't go up while
+ * we hold the lock.
+ *
+ * Writes and truncates through the file system update the cached
+ * frames in place (pagecache_update, pagecache_truncate), so shared
+ * mappings and the file never disagree about a page for long.
+ *
+ * Shared mappings write to the cached frames directly. vm_fault marks
+ * a frame dirty in the coremap on the first write, as for any other
+ * page, and pagecache_writeback writes dirty frames to the file. A
+ * frame only becomes clean again once nobody maps it any more, since
+ * an address space that still does may have it writeable in its TLB;
+ * until then every writeback writes it again. Dirty pages are never
+ * reclaimed.
+ */
+
+#define PC_NBUCKETS	128
+
+struct pcpage {
+	struct vnode *pp_vnode;
+	unsigned pp_index;		/* Page number within the file */
+	paddr_t pp_paddr;		/* Frame holding it */
+	struct pcpage *pp_next;		/* Hash chain */
+	struct pcpage *pp_vnext;	/* Other pages of the same vnode */
+};
+
+static struct spinlock pagecache_lock = SPINLOCK_INITIALIZER;
+static struct pcpage *pagecache_table[PC_NBUCKETS];
+static unsigned pagecache_hand;		/* Next bucket for reclaim to look at */
+
+static unsigned long pagecache_pages;
+static unsigned long pagecache_hits;
+static unsigned long pagecache_misses;
+static unsigned long pagecache_reclaimed;
+static unsigned long pagecache_purged;
+static unsigned long pagecache_written;
+
+static
+unsigned
+pagecache_hash(struct vnode *vn, unsigned index)
+{
+	return (((uintptr_t)vn >> 4) + index * 31) % PC_NBUCKETS;
+}
+
+/*
+ * Find a page. Called with pagecache_lock held.
+ */
+static
+struct pcpage *
+pagecache_lookup(struct vnode *vn, unsigned index)
+{
+	struct pcpage *pp;
+
+	for (pp = pagecache_table[pagecache_hash(vn, index)];
+	     pp != NULL; pp = pp->pp_next) {
+		if (pp->pp_vnode == vn && pp->pp_index == index) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take a page out of both the hash table and its vnode's list.
+ * Called with pagecache_lock held.
+ */
+static
+void
+pagecache_unlink(struct pcpage *pp)
+{
+	struct pcpage **p;
+
+	for (p = &pagecache_table[pagecache_hash(pp->pp_vnode, pp->pp_index)];
+	     *p != pp; p = &(*p)->pp_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = pp->pp_next;
+
+	for (p = &pp->pp_vnode->vn_pagecache;
+	     *p != pp; p = &(*p)->pp_vnext) {
+		KASSERT(*p != NULL);
+	}
+	*p = pp->pp_vnext;
+
+	pagecache_pages--;
+}
+
+/*
+ * Free a list of pages (linked through pp_next) taken out of the
+ * cache, dropping the cache's reference to each frame.
+ */
+static
+void
+pagecache_freelist(struct pcpage *pp)
+{
+	struct pcpage *next;
+
+	for (; pp != NULL; pp = next) {
+		next = pp->pp_next;
+		coremap_free(pp->pp_paddr);
+		kfree(pp);
+	}
+}
+
+/*
+ * Read bytes START to START+LEN-1 of page INDEX of VN into the same
+ * place in the frame at PADDR. Whatever lies past the end of the file
+ * reads as zeroes.
+ */
+static
+int
+pagecache_readpart(struct vnode *vn, unsigned index, paddr_t paddr,
+		   size_t start, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	char *kva;
+	int result;
+
+	kva = (char *)PADDR_TO_KVADDR(paddr) + start;
+	uio_kinit(&iov, &ku, kva, len, (off_t)index * PAGE_SIZE + start,
+		  UIO_READ);
+	result = VOP_READ(vn, &ku);
+	if (result) {
+		return result;
+	}
+	bzero(kva + len - ku.uio_resid, ku.uio_resid);
+	return 0;
+}
+
+/*
+ * Read page INDEX of VN into the frame at PADDR.
+ */
+static
+int
+pagecache_read(struct vnode *vn, unsigned index, paddr_t paddr)
+{
+	return pagecache_readpart(vn, index, paddr, 0, PAGE_SIZE);
+}
+
+/*
+ * Write the frame at PADDR back to page INDEX of VN, a file of SIZE
+ * bytes. The part past the end of the file is dropped; mappings don't
+ * make files grow. This calls the filesystem directly, since
+ * VOP_WRITE would read the page we're writing back into itself.
+ */
+static
+int
+pagecache_write(struct vnode *vn, unsigned index, paddr_t paddr, off_t size)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t offset;
+	size_t len;
+	int result;
+
+	offset = (off_t)index * PAGE_SIZE;
+	if (offset >= size) {
+		return 0;
+	}
+	len = (size - offset < PAGE_SIZE) ? size - offset : PAGE_SIZE;
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), len, offset,
+		  UIO_WRITE);
+	result = __VOP(vn, write)(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+pagecache_get(struct vnode *vn, unsigned index, paddr_t *ret)
+{
+	struct pcpage *pp, *newpp;
+	paddr_t paddr;
+	unsigned bucket;
+	int result;
+
+	spinlock_acquire(&pagecache_lock);
+	pp = pagecache_lookup(vn, index);
+	if (pp != NULL) {
+		coremap_incref(pp->pp_paddr);
+		pagecache_hits++;
+		*ret = pp->pp_paddr;
+		spinlock_release(&pagecache_lock);
+		return 0;
+	}
+	spinlock_release(&pagecache_lock);
+
+	newpp = kmalloc(sizeof(*newpp));
+	if (newpp == NULL) {
+		return ENOMEM;
+	}
+
+	/* An ownerless frame; this reference is the cache's */
+	paddr = coremap_alloc_upage(NULL, 0);
+	if (paddr == 0) {
+		kfree(newpp);
+		return ENOMEM;
+	}
+	result = pagecache_read(vn, index, paddr);
+	if (result) {
+		coremap_free(paddr);
+		kfree(newpp);
+		return result;
+	}
+
+	spinlock_acquire(&pagecache_lock);
+	pp = pagecache_lookup(vn, index);
+	if (pp != NULL) {
+		/* Someone else read it in while we were at it */
+		coremap_incref(pp->pp_paddr);
+		pagecache_hits++;
+		*ret = pp->pp_paddr;
+		spinlock_release(&pagecache_lock);
+
+		coremap_free(paddr);
+		kfree(newpp);
+		return 0;
+	}
+
+	newpp->pp_vnode = vn;
+	newpp->pp_index = index;
+	newpp->pp_paddr = paddr;
+	bucket = pagecache_hash(vn, index);
+	newpp->pp_next = pagecache_table[bucket];
+	pagecache_table[bucket] = newpp;
+	newpp->pp_vnext = vn->vn_pagecache;
+	vn->vn_pagecache = newpp;
+	pagecache_pages++;
+	pagecache_misses++;
+
+	/* And one for the caller */
+	coremap_incref(paddr);
+	*ret = paddr;
+
+	spinlock_release(&pagecache_lock);
+
+	return 0;
+}
+
+int
+pagecache_writeback(struct vnode *vn, unsigned index, unsigned npages)
+{
+	struct pcpage *pp, *next;
+	struct stat st;
+	unsigned done, pageno;
+	paddr_t paddr;
+	int result;
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Each time around, write the lowest-numbered dirty page we
+	 * haven't done yet. The list can change whenever we let go of
+	 * the lock, so start over every time.
+	 */
+	done = 0;
+	while (1) {
+		spinlock_acquire(&pagecache_lock);
+		next = NULL;
+		for (pp = vn->vn_pagecache; pp != NULL; pp = pp->pp_vnext) {
+			if (pp->pp_index - index >= npages ||
+			    pp->pp_index - index < done ||
+			    !coremap_isdirty(pp->pp_paddr)) {
+				continue;
+			}
+			if (next == NULL || pp->pp_index < next->pp_index) {
+				next = pp;
+			}
+		}
+		if (next == NULL) {
+			spinlock_release(&pagecache_lock);
+			return 0;
+		}
+		pageno = next->pp_index;
+		paddr = next->pp_paddr;
+		/* Hold on to the frame in case the page is purged meanwhile */
+		coremap_incref(paddr);
+		spinlock_release(&pagecache_lock);
+
+		result = pagecache_write(vn, pageno, paddr, st.st_size);
+
+		spinlock_acquire(&pagecache_lock);
+		if (result == 0) {
+			pagecache_written++;
+			pp = pagecache_lookup(vn, pageno);
+			if (pp != NULL && pp->pp_paddr == paddr &&
+			    coremap_refcount(paddr) == 2) {
+				/* Only the cache and us; nobody can still write it */
+				coremap_setclean(paddr, SWAP_NOSLOT);
+			}
+		}
+		spinlock_release(&pagecache_lock);
+
+		coremap_free(paddr);
+
+		if (result) {
+			return result;
+		}
+		done = pageno - index + 1;
+	}
+}
+
+int
+pagecache_flush(struct vnode *vn)
+{
+	/*
+	 * Most vnodes never have pages; don't VOP_STAT them. Unlocked,
+	 * but a page added just now can't be dirty yet anyway.
+	 */
+	if (vn->vn_pagecache == NULL) {
+		return 0;
+	}
+	return pagecache_writeback(vn, 0, (unsigned)-1);
+}
+
+void
+pagecache_update(struct vnode *vn, off_t offset, off_t len)
+{
+	struct pcpage *pp, *next;
+	unsigned first, last, done, pageno;
+	off_t pagestart, s, e;
+	paddr_t paddr;
+	int result;
+
+	KASSERT(len > 0);
+	first = offset / PAGE_SIZE;
+	last = (offset + len - 1) / PAGE_SIZE;
+
+	/* As in pagecache_writeback, one page at a time, lowest first */
+	done = first;
+	while (1) {
+		spinlock_acquire(&pagecache_lock);
+		next = NULL;
+		for (pp = vn->vn_pagecache; pp != NULL; pp = pp->pp_vnext) {
+			if (pp->pp_index < done || pp->pp_index > last) {
+				continue;
+			}
+			if (next == NULL || pp->pp_index < next->pp_index) {
+				next = pp;
+			}
+		}
+		if (next == NULL) {
+			spinlock_release(&pagecache_lock);
+			return;
+		}
+		pageno = next->pp_index;
+		paddr = next->pp_paddr;
+		coremap_incref(paddr);
+		spinlock_release(&pagecache_lock);
+
+		/*
+		 * Only the bytes just written; anything else in the page
+		 * that a shared mapping changed stays as it is.
+		 */
+		pagestart = (off_t)pageno * PAGE_SIZE;
+		s = (offset > pagestart) ? offset : pagestart;
+		e = (offset + len < pagestart + PAGE_SIZE) ?
+		    offset + len : pagestart + PAGE_SIZE;
+		result = pagecache_readpart(vn, pageno, paddr, s - pagestart,
+					    e - s);
+		if (result) {
+			/*
+			 * Don't leave a stale page for new mappings to find.
+			 * Any existing ones keep it.
+			 */
+			spinlock_acquire(&pagecache_lock);
+			pp = pagecache_lookup(vn, pageno);
+			if (pp != NULL && pp->pp_paddr == paddr) {
+				pagecache_unlink(pp);
+				pagecache_purged++;
+				pp->pp_next = NULL;
+			}
+			else {
+				pp = NULL;
+			}
+			spinlock_release(&pagecache_lock);
+			pagecache_freelist(pp);
+		}
+
+		coremap_free(paddr);
+		done = pageno + 1;
+	}
+}
+
+void
+pagecache_truncate(struct vnode *vn, off_t size)
+{
+	struct pcpage *pp, *next, *dead;
+	off_t pagestart;
+
+	dead = NULL;
+
+	spinlock_acquire(&pagecache_lock);
+	for (pp = vn->vn_pagecache; pp != NULL; pp = next) {
+		next = pp->pp_vnext;
+		pagestart = (off_t)pp->pp_index * PAGE_SIZE;
+		if (pagestart + PAGE_SIZE <= size) {
+			continue;
+		}
+		if (pagestart >= size && coremap_refcount(pp->pp_paddr) == 1) {
+			/* Wholly past the end, and nobody maps it */
+			pagecache_unlink(pp);
+			pp->pp_next = dead;
+			dead = pp;
+			pagecache_purged++;
+			continue;
+		}
+		/* The file reads as zeroes past the end; so does the page */
+		if (pagestart >= size) {
+			bzero((void *)PADDR_TO_KVADDR(pp->pp_paddr), PAGE_SIZE);
+		}
+		else {
+			bzero((char *)PADDR_TO_KVADDR(pp->pp_paddr) + (size - pagestart),
+			      PAGE_SIZE - (size - pagestart));
+		}
+	}
+	spinlock_release(&pagecache_lock);
+
+	pagecache_freelist(dead);
+}
+
+void
+pagecache_purge(struct vnode *vn)
+{
+	struct pcpage *pp, *dead;
+
+	dead = NULL;
+
+	spinlock_acquire(&pagecache_lock);
+	while (vn->vn_pagecache != NULL) {
+		pp = vn->vn_pagecache;
+		pagecache_unlink(pp);
+		pp->pp_next = dead;
+		dead = pp;
+		pagecache_purged++;
+	}
+	spinlock_release(&pagecache_lock);
+
+	pagecache_freelist(dead);
+}
+
+unsigned
+pagecache_reclaim(unsigned max)
+{
+	struct pcpage *pp, *next, *dead;
+	unsigned i, n;
+
+	dead = NULL;
+	n = 0;
+
+	spinlock_acquire(&pagecache_lock);
+	for (i = 0; i < PC_NBUCKETS && n < max; i++) {
+		pp = pagecache_table[pagecache_hand];
+		for (; pp != NULL && n < max; pp = next) {
+			next = pp->pp_next;
+			if (coremap_refcount(pp->pp_paddr) == 1 &&
+			    !coremap_isdirty(pp->pp_paddr)) {
+				pagecache_unlink(pp);
+				pp->pp_next = dead;
+				dead = pp;
+				n++;
+			}
+		}
+		pagecache_hand = (pagecache_hand + 1) % PC_NBUCKETS;
+	}
+	pagecache_reclaimed += n;
+	spinlock_release(&pagecache_lock);
+
+	pagecache_freelist(dead);
+
+	return n;
+}
+
+void
+pagecache_getstats(struct pagecache_stats *ps)
+{
+	spinlock_acquire(&pagecache_lock);
+	ps->ps_pages = pagecache_pages;
+	ps->ps_hits = pagecache_hits;
+	ps->ps_misses = pagecache_misses;
+	ps->ps_reclaimed = pagecache_reclaimed;
+	ps->ps_purged = pagecache_purged;
+	ps->ps_written = pagecache_written;
+	spinlock_release(&pagecache_lock);
+}
+
+void
+pagecache_printstats(void)
+{
+	struct pagecache_stats ps;
+
+	pagecache_getstats(&ps);
+
+	kprintf("Page cache: %lu pages\n", ps.ps_pages);
+	kprintf("    hits:      %8lu\n", ps.ps_hits);
+	kprintf("    misses:    %8lu\n", ps.ps_misses);
+	kprintf("    reclaimed: %8lu\n", ps.ps_reclaimed);
+	kprintf("    purged:    %8lu\n", ps.ps_purged);
+	kprintf("    written:   %8lu\n", ps.ps_written);
+}
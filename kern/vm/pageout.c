@@ -0,0 +1,138 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pageout.h>
+
+/*
+ * Pageout thread. See pageout.h.
+ */
+
+/* Dirty pages to write out each time the thread wakes up */
+#define PAGEOUT_BATCH	16
+
+/* Default low watermark: this fraction of memory, but at least the minimum */
+#define PAGEOUT_LOWFRAC 32
+#define PAGEOUT_LOWMIN	8
+
+/*
+ * Protects the watermarks and counters.
+ */
+static struct spinlock pageout_lock = SPINLOCK_INITIALIZER;
+
+static unsigned long pageout_lowater;
+static unsigned long pageout_hiwater;
+static unsigned long pageout_maxfree;	/* Frames free at boot */
+
+static unsigned long pageout_wakeups;
+static unsigned long pageout_cleaned;
+static unsigned long pageout_reclaimed;
+
+static
+void
+pageout_thread(void *unused1, unsigned long unused2)
+{
+	struct coremap_stats cs;
+	unsigned long high, reclaimed;
+	unsigned cleaned;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		coremap_pageout_wait();
+
+		/*
+		 * Clean first, so the pages we are about to evict are
+		 * mostly ones that don't need writing.
+		 */
+		cleaned = coremap_clean(PAGEOUT_BATCH);
+
+		reclaimed = 0;
+		while (1) {
+			spinlock_acquire(&pageout_lock);
+			high = pageout_hiwater;
+			spinlock_release(&pageout_lock);
+
+			coremap_getstats(&cs);
+			if (cs.cs_free + cs.cs_zeroed >= high || !coremap_reclaim()) {
+				break;
+			}
+			reclaimed++;
+		}
+
+		spinlock_acquire(&pageout_lock);
+		pageout_wakeups++;
+		pageout_cleaned += cleaned;
+		pageout_reclaimed += reclaimed;
+		spinlock_release(&pageout_lock);
+
+		if (cleaned == 0 && reclaimed == 0) {
+			/* Everything is busy or shared; don't spin */
+			clocksleep(1);
+		}
+	}
+}
+
+void
+pageout_bootstrap(void)
+{
+	struct coremap_stats cs;
+	int result;
+
+	coremap_getstats(&cs);
+
+	pageout_maxfree = cs.cs_free;
+	pageout_lowater = pageout_maxfree / PAGEOUT_LOWFRAC;
+	if (pageout_lowater < PAGEOUT_LOWMIN) {
+		pageout_lowater = PAGEOUT_LOWMIN;
+	}
+	pageout_hiwater = 2 * pageout_lowater;
+	coremap_setlowater(pageout_lowater);
+
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		panic("pageout: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+pageout_setwatermarks(unsigned long low, unsigned long high)
+{
+	if (low == 0 || low >= high || high > pageout_maxfree) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&pageout_lock);
+	pageout_lowater = low;
+	pageout_hiwater = high;
+	spinlock_release(&pageout_lock);
+
+	coremap_setlowater(low);
+
+	return 0;
+}
+
+void
+pageout_printstats(void)
+{
+	unsigned long low, high, wakeups, cleaned, reclaimed;
+
+	spinlock_acquire(&pageout_lock);
+	low = pageout_lowater;
+	high = pageout_hiwater;
+	wakeups = pageout_wakeups;
+	cleaned = pageout_cleaned;
+	reclaimed = pageout_reclaimed;
+	spinlock_release(&pageout_lock);
+
+	kprintf("Pageout: low watermark %lu pages, high watermark %lu pages\n",
+		low, high);
+	kprintf("    wakeups:   %8lu\n", wakeups);
+	kprintf("    cleaned:   %8lu\n", cleaned);
+	kprintf("    reclaimed: %8lu\n", reclaimed);
+}
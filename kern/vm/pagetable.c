@@ -0,0 +1,98 @@
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+/*
+ * Two-level page tables. See pagetable.h.
+ *
+ * Second-level tables are exactly one page each, so they come
+ * straight from kmalloc's whole-page path.
+ */
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	bzero(pt->pt_dir, sizeof(pt->pt_dir));
+
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	KASSERT(pt != NULL);
+
+	for (i = 0; i < PT_NENTRIES; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *l2;
+
+	l2 = pt->pt_dir[PT_L1_INDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_NENTRIES * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		bzero(l2, PT_NENTRIES * sizeof(pte_t));
+		pt->pt_dir[PT_L1_INDEX(vaddr)] = l2;
+	}
+
+	return &l2[PT_L2_INDEX(vaddr)];
+}
+
+int
+pt_walk(struct pagetable *pt, vaddr_t start, vaddr_t end,
+	int (*func)(vaddr_t vaddr, pte_t *pte, void *arg), void *arg)
+{
+	vaddr_t va;
+	pte_t *l2;
+	int result;
+
+	KASSERT((start & PAGE_FRAME) == start);
+
+	va = start;
+	while (va < end) {
+		l2 = pt->pt_dir[PT_L1_INDEX(va)];
+		if (l2 == NULL) {
+			/* Skip to the start of the next second-level table */
+			va = (va & ~(vaddr_t)(PT_L1_SPAN - 1)) + PT_L1_SPAN;
+			if (va == 0) {
+				/* Wrapped around the top of the address space */
+				break;
+			}
+			continue;
+		}
+		if (l2[PT_L2_INDEX(va)] != 0) {
+			result = func(va, &l2[PT_L2_INDEX(va)], arg);
+			if (result) {
+				return result;
+			}
+		}
+		va += PAGE_SIZE;
+		if (va == 0) {
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/*
+ * Swap space. Slot N is the page at byte offset N * PAGE_SIZE of the
+ * swap device.
+ */
+
+static struct vnode *swap_vnode = NULL;
+static struct bitmap *swap_map = NULL;
+static unsigned long swap_nslots;
+
+/*
+ * Protects swap_map and the counters.
+ */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+static unsigned long swap_used;
+static unsigned long swap_pageins;
+static unsigned long swap_pageouts;
+
+void
+swap_bootstrap(void)
+{
+	struct vnode *vn;
+	struct stat st;
+	int result;
+
+	result = vfs_swapon(SWAP_DEVICE, &vn);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n", SWAP_DEVICE,
+			strerror(result));
+		return;
+	}
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		kprintf("swap: %s: stat: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		VOP_DECREF(vn);
+		vfs_swapoff(SWAP_DEVICE);
+		return;
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots > PTE_MAXSLOTS) {
+		/* Page table entries can't address any more than this */
+		swap_nslots = PTE_MAXSLOTS;
+	}
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; running without swap\n",
+			SWAP_DEVICE);
+		VOP_DECREF(vn);
+		vfs_swapoff(SWAP_DEVICE);
+		return;
+	}
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: cannot allocate bitmap for %lu slots\n", swap_nslots);
+	}
+	swap_vnode = vn;
+
+	kprintf("swap: %lu pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	if (swap_map == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_used++;
+	}
+	spinlock_release(&swap_lock);
+
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(swap_map != NULL);
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_used--;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Move one page between memory and swap.
+ */
+static
+int
+swap_io(unsigned slot, paddr_t paddr, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+
+	return 0;
+}
+
+int
+swap_out(unsigned slot, paddr_t paddr)
+{
+	int result;
+
+	result = swap_io(slot, paddr, UIO_WRITE);
+	if (result == 0) {
+		spinlock_acquire(&swap_lock);
+		swap_pageouts++;
+		spinlock_release(&swap_lock);
+	}
+	return result;
+}
+
+int
+swap_in(unsigned slot, paddr_t paddr)
+{
+	int result;
+
+	result = swap_io(slot, paddr, UIO_READ);
+	if (result == 0) {
+		spinlock_acquire(&swap_lock);
+		swap_pageins++;
+		spinlock_release(&swap_lock);
+	}
+	return result;
+}
+
+void
+swap_getstats(struct swap_stats *ss)
+{
+	spinlock_acquire(&swap_lock);
+	ss->ss_slots = swap_nslots;
+	ss->ss_used = swap_used;
+	ss->ss_pageins = swap_pageins;
+	ss->ss_pageouts = swap_pageouts;
+	spinlock_release(&swap_lock);
+}
+
+void
+swap_printstats(void)
+{
+	struct swap_stats ss;
+
+	swap_getstats(&ss);
+
+	if (ss.ss_slots == 0) {
+		kprintf("Swap: none\n");
+		return;
+	}
+	kprintf("Swap: %lu of %lu pages used\n", ss.ss_used, ss.ss_slots);
+	kprintf("    page-ins:  %8lu\n", ss.ss_pageins);
+	kprintf("    page-outs: %8lu\n", ss.ss_pageouts);
+}
@@ -0,0 +1,802 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <spl.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <pageout.h>
+#include <pagecache.h>
+
+/*
+ * Demand-paged VM system.
+ *
+ * Address spaces are a list of regions plus a sparse page table (see
+ * addrspace.c and pagetable.c). No page is allocated until it is
+ * first touched: vm_fault finds the region containing the faulting
+ * address, materializes a frame for it if the page table doesn't
+ * have one yet, and loads the translation into the TLB. The new
+ * frame is zero-filled, or read from the file the region maps; this
+ * is how executables are loaded. Zero-filled pages mostly come from
+ * a pool that idle cpus keep filled (coremap_zero_idle), so the
+ * faulting thread doesn't have to clear them. The stack region
+ * grows down to cover faults just below it (see as_grow_stack).
+ *
+ * Pages of a private file mapping that lie wholly within the file
+ * come from the page cache instead (see pagecache.c), so every
+ * process running a program shares one copy of its text. They are
+ * mapped PTE_COW like pages shared by fork, and a process that
+ * writes to one gets its own copy. Pages of shared mappings (mmap
+ * with MAP_SHARED) are the cached pages themselves.
+ *
+ * Fork shares every resident page between parent and child (see
+ * as_copy) and marks them PTE_COW. Such pages are mapped read-only;
+ * the first write to one faults, and vm_fault then gives the writer
+ * a private copy, unless nobody else is left sharing the frame.
+ *
+ * When memory runs out the coremap picks a page to evict and calls
+ * vm_evict, which writes it to swap and leaves the swap slot in the
+ * page table entry (PTE_SWAP). vm_fault reads it back on the next
+ * touch. Pages are mapped writeable only once they are dirty, so the
+ * coremap knows which pages still match their copy in swap and can
+ * be evicted without writing them out again.
+ *
+ * Most TLB faults are for pages that are resident and already have
+ * everything set up; vm_refill handles those straight from the page
+ * table without taking the address space lock. PTE_WRITE records
+ * which pages may be mapped writeable, so that a refill never needs
+ * to look at the region list or the coremap. Anything else takes the
+ * slow path in vm_fault.
+ */
+
+/* Serializes vm_shootdown */
+static struct lock *vm_shootdown_lock;
+static struct semaphore *vm_shootdown_sem;
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+
+	vm_shootdown_lock = lock_create("vm_shootdown");
+	vm_shootdown_sem = sem_create("vm_shootdown", 0);
+	if (vm_shootdown_lock == NULL || vm_shootdown_sem == NULL) {
+		panic("vm_bootstrap: out of memory\n");
+	}
+
+	swap_bootstrap();
+	pageout_bootstrap();
+}
+
+/*
+ * Check if we're in a context that can sleep. See the comment on the
+ * same check in dumbvm.c.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t paddr;
+
+	vm_can_sleep();
+
+	paddr = coremap_alloc_kpages(npages);
+	if (paddr == 0) {
+		return 0;
+	}
+
+	return PADDR_TO_KVADDR(paddr);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * Carry out one shootdown request on this cpu.
+ */
+static
+void
+vm_invalidate(const struct tlbshootdown *ts)
+{
+	if (ts->ts_vaddr == TLBSHOOTDOWN_ALL) {
+		vmtlb_drop(ts->ts_as);
+	}
+	else {
+		vmtlb_invalidate(ts->ts_as, ts->ts_vaddr);
+	}
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vm_invalidate(ts);
+	if (ts->ts_done != NULL) {
+		V(ts->ts_done);
+	}
+}
+
+/*
+ * Shoot down VADDRS[] in AS here and on other cpus: if NCPUS is 0,
+ * on each cpu whose TLB may have mappings for AS, otherwise on the
+ * first NCPUS others. Wait for them, and return how many there were.
+ *
+ * The batch goes to each cpu with a single IPI. Only the last entry
+ * carries the semaphore, so each cpu V's it once, after it has done
+ * the whole batch. Since we hold vm_shootdown_lock until every cpu
+ * is done, nobody else's requests can be queued at the same time
+ * and the queues never overflow.
+ */
+static
+unsigned
+vm_shootdown_cpus(struct addrspace *as, const vaddr_t *vaddrs, unsigned n,
+		  unsigned ncpus)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	struct vmtlb_stats *stats;
+	struct cpu *c;
+	unsigned i, nts, numcpus, sent;
+	int spl;
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if (n > TLBSHOOTDOWN_MAX) {
+		/* Cheaper to drop everything than to look for each page */
+		ts[0].ts_as = as;
+		ts[0].ts_vaddr = TLBSHOOTDOWN_ALL;
+		ts[0].ts_done = NULL;
+		nts = 1;
+	}
+	else {
+		for (i = 0; i < n; i++) {
+			ts[i].ts_as = as;
+			ts[i].ts_vaddr = vaddrs[i];
+			ts[i].ts_done = NULL;
+		}
+		nts = n;
+	}
+	ts[nts - 1].ts_done = vm_shootdown_sem;
+
+	lock_acquire(vm_shootdown_lock);
+
+	/* Don't migrate to another cpu halfway through */
+	spl = splhigh();
+
+	for (i = 0; i < nts; i++) {
+		vm_invalidate(&ts[i]);
+	}
+
+	sent = 0;
+	numcpus = cpu_count();
+	for (i = 0; i < numcpus; i++) {
+		c = cpu_get(i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		if (ncpus > 0 ? sent == ncpus : !vmtlb_mayhave(as, c)) {
+			continue;
+		}
+		ipi_tlbshootdown_batch(c, ts, nts);
+		sent++;
+	}
+
+	stats = &curcpu->c_tlbstats;
+	stats->ts_ipis += sent;
+	stats->ts_skipped += numcpus - 1 - sent;
+
+	splx(spl);
+
+	for (i = 0; i < sent; i++) {
+		P(vm_shootdown_sem);
+	}
+
+	lock_release(vm_shootdown_lock);
+
+	return sent;
+}
+
+void
+vm_shootdown(struct addrspace *as, const vaddr_t *vaddrs, unsigned n)
+{
+	vm_shootdown_cpus(as, vaddrs, n, 0);
+}
+
+unsigned
+vm_shootdown_ncpus(struct addrspace *as, const vaddr_t *vaddrs, unsigned n,
+		   unsigned ncpus)
+{
+	KASSERT(ncpus > 0);
+	return vm_shootdown_cpus(as, vaddrs, n, ncpus);
+}
+
+/*
+ * Lock the address space of a page the coremap wants to evict or
+ * clean, and find its page table entry. Sets *LOCKED if the lock has
+ * to be released afterwards.
+ */
+static
+int
+vm_lockpage(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+	    pte_t **ret, bool *locked)
+{
+	pte_t *pte;
+
+	/*
+	 * If we're the one who needs the frame we may already hold the
+	 * lock; otherwise don't wait for it, or we could deadlock with
+	 * the owner trying to get memory.
+	 */
+	*locked = false;
+	if (!lock_do_i_hold(as->as_lock)) {
+		if (!lock_tryacquire(as->as_lock)) {
+			return EBUSY;
+		}
+		*locked = true;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte == NULL || (*pte & (PTE_VALID | PTE_COW)) != PTE_VALID ||
+	    (*pte & PTE_FRAME) != paddr) {
+		/* Not mapped yet; we're in the middle of setting it up */
+		if (*locked) {
+			lock_release(as->as_lock);
+		}
+		return EBUSY;
+	}
+
+	*ret = pte;
+	return 0;
+}
+
+/*
+ * TLB statistics and policy.
+ */
+void
+vm_printtlbstats(void)
+{
+	struct vmtlb_stats total, *ts;
+	struct cpu *c;
+	unsigned i, n;
+
+	bzero(&total, sizeof(total));
+
+	kprintf("TLB replacement: %s\n",
+		vmtlb_policy == VMTLB_ROUNDROBIN ? "round-robin" : "random");
+	kprintf("cpu     misses    refills  slow path      loads      asids"
+		"    flushes\n");
+
+	n = cpu_count();
+	for (i = 0; i < n; i++) {
+		c = cpu_get(i);
+		ts = &c->c_tlbstats;
+		kprintf("%3u %10lu %10lu %10lu %10lu %10lu %10lu\n", i,
+			ts->ts_misses, ts->ts_refills,
+			ts->ts_misses - ts->ts_refills, ts->ts_loads,
+			ts->ts_asids, ts->ts_flushes);
+		total.ts_misses += ts->ts_misses;
+		total.ts_refills += ts->ts_refills;
+		total.ts_loads += ts->ts_loads;
+		total.ts_asids += ts->ts_asids;
+		total.ts_flushes += ts->ts_flushes;
+		total.ts_ipis += ts->ts_ipis;
+		total.ts_skipped += ts->ts_skipped;
+	}
+	kprintf("all %10lu %10lu %10lu %10lu %10lu %10lu\n",
+		total.ts_misses, total.ts_refills,
+		total.ts_misses - total.ts_refills, total.ts_loads,
+		total.ts_asids, total.ts_flushes);
+	kprintf("Shootdowns: %lu IPIs sent, %lu cpus skipped\n",
+		total.ts_ipis, total.ts_skipped);
+}
+
+void
+vm_resettlbstats(void)
+{
+	unsigned i, n;
+
+	/* Racy against the other cpus, but these are only counters */
+	n = cpu_count();
+	for (i = 0; i < n; i++) {
+		bzero(&cpu_get(i)->c_tlbstats, sizeof(struct vmtlb_stats));
+	}
+}
+
+int
+vm_setpolicy(int policy)
+{
+	if (policy != VMTLB_RANDOM && policy != VMTLB_ROUNDROBIN) {
+		return EINVAL;
+	}
+	vmtlb_policy = policy;
+	return 0;
+}
+
+int
+vm_evict(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	pte_t *pte;
+	unsigned slot;
+	bool locked;
+	int result;
+
+	result = vm_lockpage(as, vaddr, paddr, &pte, &locked);
+	if (result) {
+		return result;
+	}
+
+	if (!coremap_isdirty(paddr)) {
+		/* Swap has a copy, or the page is as vm_fault first filled it */
+		slot = coremap_takeslot(paddr);
+		*pte = (slot == SWAP_NOSLOT) ? 0 : PTE_MKSWAP(slot);
+		vm_shootdown(as, &vaddr, 1);
+		goto out;
+	}
+
+	result = swap_alloc(&slot);
+	if (result) {
+		goto out;
+	}
+
+	/*
+	 * Unmap the page before writing it out, so nobody can change it
+	 * behind our back. The owner will block in vm_fault until we let
+	 * go of the address space.
+	 */
+	*pte = PTE_MKSWAP(slot);
+	vm_shootdown(as, &vaddr, 1);
+
+	result = swap_out(slot, paddr);
+	if (result) {
+		swap_free(slot);
+		*pte = paddr | PTE_VALID;
+	}
+
+ out:
+	if (locked) {
+		lock_release(as->as_lock);
+	}
+	return result;
+}
+
+int
+vm_clean(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	pte_t *pte;
+	unsigned slot;
+	bool locked;
+	int result;
+
+	result = vm_lockpage(as, vaddr, paddr, &pte, &locked);
+	if (result) {
+		return result;
+	}
+
+	if (!coremap_isdirty(paddr)) {
+		goto out;
+	}
+
+	result = swap_alloc(&slot);
+	if (result) {
+		goto out;
+	}
+
+	/*
+	 * Drop any writeable TLB entry first, so that the next write
+	 * faults and marks the page dirty again. Until we let go of the
+	 * address space that write will wait. Clear PTE_WRITE before the
+	 * shootdown so a refill on another cpu can't put it back.
+	 */
+	*pte &= ~(pte_t)PTE_WRITE;
+	vm_shootdown(as, &vaddr, 1);
+
+	result = swap_out(slot, paddr);
+	if (result) {
+		swap_free(slot);
+	}
+	else {
+		coremap_setclean(paddr, slot);
+	}
+
+ out:
+	if (locked) {
+		lock_release(as->as_lock);
+	}
+	return result;
+}
+
+/*
+ * Read a swapped-out page back into memory. The caller must hold the
+ * address space lock.
+ */
+static
+int
+vm_pagein(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t paddr;
+	unsigned slot;
+	int result;
+
+	KASSERT(*pte & PTE_SWAP);
+	slot = PTE_SLOT(*pte);
+
+	paddr = coremap_alloc_upage(as, vaddr);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	result = swap_in(slot, paddr);
+	if (result) {
+		coremap_free(paddr);
+		return result;
+	}
+
+	/* The slot stays with the page until the page is changed */
+	coremap_setclean(paddr, slot);
+	*pte = paddr | PTE_VALID;
+
+	return 0;
+}
+
+/*
+ * True if nothing on the page at VADDR in region RG comes from a
+ * file, so that it starts out all zeroes.
+ */
+static
+bool
+vm_zerofill(struct region *rg, vaddr_t vaddr)
+{
+	return rg->rg_vnode == NULL ||
+	    vaddr + PAGE_SIZE <= rg->rg_filebase ||
+	    vaddr >= rg->rg_filebase + rg->rg_filesize;
+}
+
+/*
+ * Fill a newly allocated frame for the page at VADDR in region RG:
+ * read in the part of it the region maps from a file, and zero the
+ * rest. The caller must hold the address space lock.
+ *
+ * The page counts as clean with no swap copy, so the coremap may
+ * throw it away as long as it is unchanged; it will be read in again
+ * on the next fault.
+ */
+static
+int
+vm_fill(struct region *rg, vaddr_t vaddr, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end, fileend;
+	char *kva;
+	int result;
+
+	kva = (char *)PADDR_TO_KVADDR(paddr);
+
+	start = vaddr;
+	end = vaddr + PAGE_SIZE;
+	if (rg->rg_vnode != NULL) {
+		fileend = rg->rg_filebase + rg->rg_filesize;
+		if (start < rg->rg_filebase) {
+			start = rg->rg_filebase;
+		}
+		if (end > fileend) {
+			end = fileend;
+		}
+	}
+	if (rg->rg_vnode == NULL || start >= end) {
+		/* Nothing from the file on this page */
+		bzero(kva, PAGE_SIZE);
+		return 0;
+	}
+
+	bzero(kva, start - vaddr);
+	bzero(kva + (end - vaddr), vaddr + PAGE_SIZE - end);
+
+	uio_kinit(&iov, &ku, kva + (start - vaddr), end - start,
+		  rg->rg_offset + (start - rg->rg_filebase), UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* The file got shorter since it was mapped */
+		return EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * If the page at VADDR in region RG comes from the page cache, return
+ * true and the page's index in the file in *INDEX. Pages of shared
+ * mappings always do. Private mappings only use the cache for pages
+ * that are all file contents and start on a page boundary in the
+ * file; the rest get a page of their own from vm_fill.
+ */
+static
+bool
+vm_cacheable(struct region *rg, vaddr_t vaddr, unsigned *index)
+{
+	off_t offset;
+
+	if (rg->rg_vnode == NULL) {
+		return false;
+	}
+	if (vaddr < rg->rg_filebase) {
+		KASSERT(!(rg->rg_flags & RGF_SHARED));
+		return false;
+	}
+	offset = rg->rg_offset + (vaddr - rg->rg_filebase);
+	if (!(rg->rg_flags & RGF_SHARED) &&
+	    (vaddr - rg->rg_filebase + PAGE_SIZE > rg->rg_filesize ||
+	     offset % PAGE_SIZE != 0)) {
+		return false;
+	}
+	*index = offset / PAGE_SIZE;
+	return true;
+}
+
+/*
+ * Resolve a fault on a copy-on-write page: take a private copy, or
+ * just take the frame if nobody else is left sharing it. The caller
+ * must hold the address space lock.
+ */
+static
+int
+vm_copy_on_write(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpaddr, newpaddr;
+
+	KASSERT((*pte & (PTE_VALID | PTE_COW)) == (PTE_VALID | PTE_COW));
+
+	oldpaddr = *pte & PTE_FRAME;
+	if (coremap_refcount(oldpaddr) == 1) {
+		/* Everyone else has already let go; just take it */
+		coremap_setowner(oldpaddr, as, vaddr);
+		*pte &= ~PTE_COW;
+		return 0;
+	}
+
+	newpaddr = coremap_alloc_upage(as, vaddr);
+	if (newpaddr == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+	coremap_setdirty(newpaddr);
+	*pte = newpaddr | PTE_VALID;
+
+	/* Drop our reference to the shared frame */
+	coremap_free(oldpaddr);
+
+	return 0;
+}
+
+/*
+ * TLB refill fast path. If the page is resident and the page table
+ * alone says the access is allowed, load the mapping and return true.
+ *
+ * This runs with interrupts off instead of holding the address space
+ * lock. Anyone who takes away a mapping changes the page table entry
+ * first and then shoots down the TLB entry on every cpu; if we read
+ * the old entry, the shootdown can't reach us until we have finished
+ * loading it, and then removes it again. Page tables are only freed
+ * by as_destroy, which can't run while we are using the address
+ * space.
+ *
+ * Copy-on-write pages can be refilled for reading; PTE_WRITE is
+ * never set on them.
+ */
+static
+bool
+vm_refill(struct addrspace *as, int faulttype, vaddr_t vaddr)
+{
+	pte_t *pte, entry;
+	bool done;
+	int spl;
+
+	done = false;
+
+	spl = splhigh();
+	curcpu->c_tlbstats.ts_misses++;
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte != NULL) {
+		entry = *pte;
+		if ((entry & PTE_VALID) &&
+		    (faulttype == VM_FAULT_READ || (entry & PTE_WRITE))) {
+			coremap_touch(entry & PTE_FRAME);
+			vmtlb_load(vaddr, entry & PTE_FRAME, (entry & PTE_WRITE) != 0);
+			curcpu->c_tlbstats.ts_refills++;
+			done = true;
+		}
+	}
+
+	splx(spl);
+
+	return done;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	paddr_t paddr;
+	unsigned index;
+	bool writeable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (vm_refill(as, faulttype, faultaddress)) {
+		return 0;
+	}
+
+	lock_acquire(as->as_lock);
+
+	rg = as_find_region(as, faultaddress);
+	if (rg == NULL) {
+		/* Maybe just below the stack */
+		rg = as_grow_stack(as, faultaddress);
+	}
+	if (rg == NULL || (rg->rg_perms == 0 && !as->as_loading)) {
+		/* Not mapped, or mapped PROT_NONE */
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	writeable = (rg->rg_perms & RG_WRITE) || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	if (*pte & PTE_SWAP) {
+		result = vm_pagein(as, faultaddress, pte);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+	else if (!(*pte & PTE_VALID) &&
+		 vm_cacheable(rg, faultaddress, &index)) {
+		/* First touch of a cached file page */
+		result = pagecache_get(rg->rg_vnode, index, &paddr);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		if (!(rg->rg_flags & RGF_SHARED)) {
+			*pte |= PTE_COW;
+		}
+	}
+	else if (!(*pte & PTE_VALID) && vm_zerofill(rg, faultaddress)) {
+		/* First touch of an anonymous page; try the zero pool */
+		paddr = coremap_alloc_zpage(as, faultaddress);
+		if (paddr == 0) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+		*pte = paddr | PTE_VALID;
+	}
+	else if (!(*pte & PTE_VALID)) {
+		/* First touch */
+		paddr = coremap_alloc_upage(as, faultaddress);
+		if (paddr == 0) {
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+		result = vm_fill(rg, faultaddress, paddr);
+		if (result) {
+			coremap_free(paddr);
+			lock_release(as->as_lock);
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+	}
+
+	if (*pte & PTE_COW) {
+		if (faulttype == VM_FAULT_READ &&
+		    coremap_refcount(*pte & PTE_FRAME) > 1) {
+			/* Keep sharing until somebody writes */
+			writeable = false;
+		}
+		else {
+			result = vm_copy_on_write(as, faultaddress, pte);
+			if (result) {
+				lock_release(as->as_lock);
+				return result;
+			}
+		}
+	}
+
+	paddr = *pte & PTE_FRAME;
+
+	/*
+	 * Clean pages are mapped read-only, so that the first write
+	 * faults and we can note that the copy in swap is now stale.
+	 */
+	if (writeable && !(*pte & PTE_COW)) {
+		if (faulttype != VM_FAULT_READ) {
+			coremap_setdirty(paddr);
+		}
+		else if (!coremap_isdirty(paddr)) {
+			writeable = false;
+		}
+	}
+
+	/* Let refills map it writeable too, unless we're only loading */
+	if (writeable && (rg->rg_perms & RG_WRITE)) {
+		*pte |= PTE_WRITE;
+	}
+
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	coremap_touch(paddr);
+	vmtlb_load(faultaddress, paddr, writeable);
+
+	lock_release(as->as_lock);
+
+	return 0;
+}
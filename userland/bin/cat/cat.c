@@ -27,6 +27,9 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 #include <err.h>
@@ -74,6 +77,45 @@ docat(const char *name, int fd)
 	}
 }
 
+/*
+ * Print a regular file that's already been opened by mapping it, so
+ * it doesn't have to be copied into a buffer first. Returns 0 if the
+ * file can't be mapped; then the caller should read it instead.
+ */
+static
+int
+mapcat(const char *name, int fd)
+{
+	struct stat st;
+	char *p;
+	size_t size;
+	int wr, wrtot;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		return 0;
+	}
+	size = st.st_size;
+
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		return 0;
+	}
+
+	wrtot = 0;
+	while (wrtot < (int)size) {
+		wr = write(STDOUT_FILENO, p+wrtot, size-wrtot);
+		if (wr<0) {
+			err(1, "stdout");
+		}
+		wrtot += wr;
+	}
+
+	if (munmap(p, size) < 0) {
+		err(1, "%s: munmap", name);
+	}
+	return 1;
+}
+
 /* Print a file by name. */
 static
 void
@@ -97,7 +139,9 @@ cat(const char *file)
 	if (fd<0) {
 		err(1, "%s", file);
 	}
-	docat(file, fd);
+	if (!mapcat(file, fd)) {
+		docat(file, fd);
+	}
 	close(fd);
 }
 
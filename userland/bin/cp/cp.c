@@ -27,6 +27,9 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <err.h>
 
@@ -36,6 +39,59 @@
  */
 
 
+/*
+ * Write LEN bytes at BUF to TOFD, named TO.
+ */
+static
+void
+writeall(const char *to, int tofd, const char *buf, int len)
+{
+	int wr, wrtot;
+
+	/*
+	 * We may actually write less than we attempted to. So loop
+	 * until we're done.
+	 */
+	wrtot = 0;
+	while (wrtot < len) {
+		wr = write(tofd, buf+wrtot, len-wrtot);
+		if (wr<0) {
+			err(1, "%s", to);
+		}
+		wrtot += wr;
+	}
+}
+
+/*
+ * Copy a regular file by mapping it and writing the mapping out,
+ * which saves copying it through a buffer. Returns 0 if the file
+ * can't be mapped; then the caller should read it instead.
+ */
+static
+int
+mapcopy(const char *from, int fromfd, const char *to, int tofd)
+{
+	struct stat st;
+	char *p;
+	size_t size;
+
+	if (fstat(fromfd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0) {
+		return 0;
+	}
+	size = st.st_size;
+
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fromfd, 0);
+	if (p == MAP_FAILED) {
+		return 0;
+	}
+	writeall(to, tofd, p, size);
+	if (munmap(p, size) < 0) {
+		err(1, "%s: munmap", from);
+	}
+	return 1;
+}
+
 /* Copy one file to another. */
 static
 void
@@ -44,7 +100,7 @@ copy(const char *from, const char *to)
 	int fromfd;
 	int tofd;
 	char buf[1024];
-	int len, wr, wrtot;
+	int len;
 
 	/*
 	 * Open the files, and give up if they won't open
@@ -58,24 +114,18 @@ copy(const char *from, const char *to)
 		err(1, "%s", to);
 	}
 
-	/*
-	 * As long as we get more than zero bytes, we haven't hit EOF.
-	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
-	 */
-	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
+	if (mapcopy(from, fromfd, to, tofd)) {
+		len = 0;
+	}
+	else {
 		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
+		 * As long as we get more than zero bytes, we haven't
+		 * hit EOF. Zero means EOF. Less than zero means an
+		 * error occurred. We may read less than we asked for,
+		 * though, in various cases for various reasons.
 		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(tofd, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "%s", to);
-			}
-			wrtot += wr;
+		while ((len = read(fromfd, buf, sizeof(buf)))>0) {
+			writeall(to, tofd, buf, len);
 		}
 	}
 	/*
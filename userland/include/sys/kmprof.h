@@ -0,0 +1,17 @@
+#ifndef _SYS_KMPROF_H_
+#define _SYS_KMPROF_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the KMPROF_* operations and struct kmprof_stats from the kernel.
+ */
+#include <kern/kmprof.h>
+
+/*
+ * Do kmalloc profiler operation OP, and if STATS isn't NULL fill it
+ * in with what the profiler has recorded.
+ */
+int __kmprof(int op, struct kmprof_stats *stats);
+
+#endif /* _SYS_KMPROF_H_ */
@@ -0,0 +1,21 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the PROT_*, MAP_* and MS_* constants from the kernel.
+ */
+#include <kern/mman.h>
+
+/*
+ * Map LEN bytes of the file open on FD, starting at OFFSET (a
+ * multiple of the page size), or zero-filled memory with MAP_ANON,
+ * in which case FD is ignored. ADDR is a hint unless MAP_FIXED is
+ * given. Pages past the end of the file read as zeroes.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+
+#endif /* _SYS_MMAN_H_ */
@@ -147,7 +147,11 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+/* Rounded up to the kernel's clock tick; *rem is always set to 0. */
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+/* Bit N of MASK allows cpu N; PID 0 is the calling process. */
+int setaffinity(pid_t pid, unsigned mask);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -0,0 +1,117 @@
+/*
+ * kmprof - control the kernel's kmalloc profiler and show what it found.
+ * Usage: kmprof [start | stop | reset]
+ *
+ * With no argument, just prints what the profiler has recorded: the
+ * allocations and frees of each block size and the allocation rate,
+ * and for each kmalloc call site (busiest first) its allocations,
+ * frees, bytes still allocated, and bytes ever allocated. With an
+ * argument, does that to the profiler first. Call sites are kernel
+ * addresses; look them up with os161-addr2line.
+ */
+
+#include <sys/types.h>
+#include <sys/kmprof.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+static struct kmprof_stats stats;
+
+static
+void
+printsizes(void)
+{
+	unsigned i, rate;
+
+	printf("%-6s %10s %10s %10s\n", "size", "allocs", "frees",
+	       "allocs/s");
+	for (i=0; i<KMPROF_NSIZES; i++) {
+		if (stats.kp_sizes[i].kz_size == 0) {
+			printf("%-6s", "pages");
+		}
+		else {
+			printf("%-6u", stats.kp_sizes[i].kz_size);
+		}
+		rate = 0;
+		if (stats.kp_msecs > 0) {
+			rate = (unsigned)((unsigned long long)
+					  stats.kp_sizes[i].kz_allocs * 1000
+					  / stats.kp_msecs);
+		}
+		printf(" %10u %10u %10u\n", stats.kp_sizes[i].kz_allocs,
+		       stats.kp_sizes[i].kz_frees, rate);
+	}
+}
+
+static
+void
+printsites(void)
+{
+	struct kmprof_site tmp, *site;
+	unsigned i, j, best;
+
+	/* Busiest first */
+	for (i=0; i<stats.kp_nsites; i++) {
+		best = i;
+		for (j=i+1; j<stats.kp_nsites; j++) {
+			if (stats.kp_sites[j].ks_allocs >
+			    stats.kp_sites[best].ks_allocs) {
+				best = j;
+			}
+		}
+		tmp = stats.kp_sites[i];
+		stats.kp_sites[i] = stats.kp_sites[best];
+		stats.kp_sites[best] = tmp;
+	}
+
+	printf("%-10s %10s %10s %10s %10s\n", "callsite", "allocs", "frees",
+	       "live", "bytes");
+	for (i=0; i<stats.kp_nsites; i++) {
+		site = &stats.kp_sites[i];
+		printf("0x%08x %10u %10u %10u %10u\n", site->ks_callsite,
+		       site->ks_allocs, site->ks_frees, site->ks_livebytes,
+		       site->ks_totalbytes);
+	}
+	if (stats.kp_lostsites > 0) {
+		printf("%u allocations from call sites not shown\n",
+		       stats.kp_lostsites);
+	}
+	if (stats.kp_untracked > 0) {
+		printf("%u blocks not tracked to their frees\n",
+		       stats.kp_untracked);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int op;
+
+	if (argc == 1) {
+		op = KMPROF_GET;
+	}
+	else if (argc == 2 && !strcmp(argv[1], "start")) {
+		op = KMPROF_START;
+	}
+	else if (argc == 2 && !strcmp(argv[1], "stop")) {
+		op = KMPROF_STOP;
+	}
+	else if (argc == 2 && !strcmp(argv[1], "reset")) {
+		op = KMPROF_RESET;
+	}
+	else {
+		errx(1, "Usage: kmprof [start | stop | reset]");
+	}
+
+	if (__kmprof(op, &stats) < 0) {
+		err(1, "__kmprof");
+	}
+
+	printf("kmalloc profiler: %s, %u.%03u s recorded\n",
+	       stats.kp_enabled ? "on" : "off",
+	       stats.kp_msecs / 1000, stats.kp_msecs % 1000);
+	printsizes();
+	printsites();
+	return 0;
+}
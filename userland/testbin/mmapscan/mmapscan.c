@@ -0,0 +1,151 @@
+/*
+ * mmapscan - compare scanning a file with read() and with mmap().
+ * Usage: mmapscan [kbytes]
+ *
+ * Writes a test file of the given size (default 512K), then checksums
+ * it several times each way: with read() into a small buffer, and by
+ * mapping it and reading the mapping. Prints the time each pass took.
+ * The first mmap pass has to fault every page in; later ones find the
+ * pages in the page cache, though they still take a fault per page.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define FILENAME	"mmapscan.dat"
+#define DEFAULT_KB	512
+#define PASSES		3
+
+static char buf[4096];
+
+/* Milliseconds since some point in the past */
+static
+unsigned long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000 + nsecs / 1000000;
+}
+
+static
+void
+makefile(size_t size)
+{
+	size_t i, done;
+	int fd, len, r;
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (done = 0; done < size; done += len) {
+		len = (size - done < sizeof(buf)) ? size - done : sizeof(buf);
+		for (i = 0; i < (size_t)len; i++) {
+			buf[i] = (char)((done + i) * 7);
+		}
+		r = write(fd, buf, len);
+		if (r != len) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+	close(fd);
+}
+
+static
+unsigned
+readscan(size_t size)
+{
+	unsigned sum;
+	size_t done;
+	int fd, len, i;
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	sum = 0;
+	for (done = 0; done < size; done += len) {
+		len = read(fd, buf, sizeof(buf));
+		if (len <= 0) {
+			err(1, "%s: read", FILENAME);
+		}
+		for (i = 0; i < len; i++) {
+			sum += (unsigned char)buf[i];
+		}
+	}
+	close(fd);
+	return sum;
+}
+
+static
+unsigned
+mmapscan(size_t size)
+{
+	const unsigned char *p;
+	unsigned sum;
+	size_t i;
+	int fd;
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "%s: mmap", FILENAME);
+	}
+	sum = 0;
+	for (i = 0; i < size; i++) {
+		sum += p[i];
+	}
+	if (munmap((void *)p, size) < 0) {
+		err(1, "%s: munmap", FILENAME);
+	}
+	close(fd);
+	return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t size;
+	unsigned rsum, msum;
+	unsigned long start, rtime, mtime;
+	int i;
+
+	size = (argc > 1 ? atoi(argv[1]) : DEFAULT_KB) * 1024;
+	if (size == 0) {
+		errx(1, "Usage: mmapscan [kbytes]");
+	}
+
+	makefile(size);
+
+	printf("mmapscan: %u KB\n", (unsigned)(size / 1024));
+	printf("pass    read ms    mmap ms\n");
+	for (i = 0; i < PASSES; i++) {
+		start = now();
+		rsum = readscan(size);
+		rtime = now() - start;
+
+		start = now();
+		msum = mmapscan(size);
+		mtime = now() - start;
+
+		if (rsum != msum) {
+			errx(1, "Checksums differ: read %u, mmap %u",
+			     rsum, msum);
+		}
+		printf("%4d %10lu %10lu\n", i + 1, rtime, mtime);
+	}
+
+	remove(FILENAME);
+	return 0;
+}
@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <err.h>
+#include <sys/mman.h>
 
 /* Larger than physical memory */
 #define SIZE  (144*1024)
@@ -54,11 +55,13 @@
  * Also, quicksort has somewhat more interesting memory usage patterns.
  */
 
+/* Scratch space for merging; an anonymous mapping, set up in main */
+static int *tmp;
+
 static
 void
 sort(int *arr, int size)
 {
-	static int tmp[SIZE];
 	int pivot, i, j, k;
 
 	if (size<2) {
@@ -128,6 +131,12 @@ check(void)
 int
 main(void)
 {
+	tmp = mmap(NULL, SIZE*sizeof(int), PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (tmp == MAP_FAILED) {
+		err(1, "mmap");
+	}
+
 	initarray();
 	sort(A, SIZE);
 	check();